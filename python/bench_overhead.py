@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""Per-call overhead of the Python bindings compared with running the solver
+binary in a subprocess and parsing its "Result = %e" line.
+
+Build both first with `make all python`, then run from the repository root:
+
+    PYTHONPATH=bin python3 python/bench_overhead.py [calls]
+
+A short interval keeps the integration itself cheap so that the timings are
+dominated by the cost of a call.
+"""
+import math
+import re
+import subprocess
+import sys
+import time
+
+import solver
+
+LEFT, RIGHT, TOL = 1.0, 1.001, 1e-06
+BINARY = "./bin/solver2_separate"
+
+
+def run_subprocess():
+    out = subprocess.run([BINARY, str(LEFT), str(RIGHT), str(TOL)],
+                         capture_output=True, text=True, check=True).stdout
+    return float(re.search(r"Result = (\S+)", out).group(1))
+
+
+def run_builtin():
+    return solver.integrate("func1", LEFT, RIGHT, TOL)
+
+
+def run_callback():
+    # Pure Python version of func1 applied to the batch of abscissae
+    def func1(xs):
+        values = []
+        for x in xs:
+            alpha = 100000.0 * math.sin(x * 100000.0)
+            y = 0.0
+            for _ in range(int(200.0 * x)):
+                y += 0.0001 * (alpha - y)
+            values.append(y)
+        return values
+
+    return solver.integrate(func1, LEFT, RIGHT, TOL)
+
+
+def bench(name, func, calls):
+    func()  # warm up
+    start = time.perf_counter()
+    for _ in range(calls):
+        result = func()
+    elapsed = time.perf_counter() - start
+    print(f"{name:<12} {elapsed / calls * 1e6:12.1f} us/call  result = {result:e}")
+    return elapsed / calls
+
+
+def main():
+    calls = int(sys.argv[1]) if len(sys.argv) > 1 else 100
+
+    sub = bench("subprocess", run_subprocess, calls)
+    builtin = bench("builtin", run_builtin, calls)
+    bench("callback", run_callback, calls)
+
+    print(f"builtin speed-up over subprocess: {sub / builtin:.1f}x")
+
+
+if __name__ == "__main__":
+    main()
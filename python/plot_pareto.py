@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""Plot the CSV written by the pareto benchmarks as log-log SVG charts of the
+error against evaluations and against time, one pair per problem.
+
+Build and run the benchmarks first, then run from the repository root:
+
+    ./bin/pareto_separate > bin/pareto.csv
+    ./bin/pareto_shared | tail -n +2 >> bin/pareto.csv
+    python3 python/plot_pareto.py bin/pareto.csv [output directory]
+
+Only the standard library is used, so that plots can be made on the login
+nodes. Errors below 1e-16 are drawn at 1e-16.
+"""
+import csv
+import math
+import os
+import sys
+from collections import defaultdict
+
+WIDTH, HEIGHT, MARGIN = 480, 360, 60
+COLOURS = ["#1f77b4", "#d62728", "#2ca02c", "#ff7f0e", "#9467bd", "#8c564b"]
+FLOOR = 1e-16
+
+
+def decades(values):
+    low = math.floor(math.log10(min(values)))
+    high = math.ceil(math.log10(max(values)))
+    return low, max(high, low + 1)
+
+
+def chart(title, xlabel, series):
+    """SVG of one log-log chart, series maps a label to (x, error) points."""
+    xs = [x for points in series.values() for x, _ in points]
+    ys = [y for points in series.values() for _, y in points]
+    x0, x1 = decades(xs)
+    y0, y1 = decades(ys)
+
+    def px(x):
+        return MARGIN + (math.log10(x) - x0) / (x1 - x0) * (WIDTH - 2 * MARGIN)
+
+    def py(y):
+        return HEIGHT - MARGIN - (math.log10(y) - y0) / (y1 - y0) * (HEIGHT - 2 * MARGIN)
+
+    out = [f'<svg xmlns="http://www.w3.org/2000/svg" width="{WIDTH}" height="{HEIGHT}" '
+           f'font-family="sans-serif" font-size="11">',
+           f'<rect width="{WIDTH}" height="{HEIGHT}" fill="white"/>',
+           f'<text x="{WIDTH / 2}" y="20" text-anchor="middle" font-size="13">{title}</text>',
+           f'<text x="{WIDTH / 2}" y="{HEIGHT - 15}" text-anchor="middle">{xlabel}</text>',
+           f'<text x="15" y="{HEIGHT / 2}" text-anchor="middle" '
+           f'transform="rotate(-90 15 {HEIGHT / 2})">absolute error</text>']
+
+    # Gridlines at each decade
+    for d in range(x0, x1 + 1):
+        x = px(10.0 ** d)
+        out.append(f'<line x1="{x:.1f}" y1="{MARGIN}" x2="{x:.1f}" y2="{HEIGHT - MARGIN}" stroke="#ddd"/>')
+        out.append(f'<text x="{x:.1f}" y="{HEIGHT - MARGIN + 15}" text-anchor="middle">1e{d}</text>')
+    for d in range(y0, y1 + 1):
+        y = py(10.0 ** d)
+        out.append(f'<line x1="{MARGIN}" y1="{y:.1f}" x2="{WIDTH - MARGIN}" y2="{y:.1f}" stroke="#ddd"/>')
+        out.append(f'<text x="{MARGIN - 5}" y="{y + 4:.1f}" text-anchor="end">1e{d}</text>')
+
+    for i, (label, points) in enumerate(sorted(series.items())):
+        colour = COLOURS[i % len(COLOURS)]
+        path = " ".join(f"{px(x):.1f},{py(y):.1f}" for x, y in sorted(points))
+        out.append(f'<polyline points="{path}" fill="none" stroke="{colour}"/>')
+        for x, y in points:
+            out.append(f'<circle cx="{px(x):.1f}" cy="{py(y):.1f}" r="3" fill="{colour}"/>')
+        out.append(f'<text x="{WIDTH - MARGIN + 5}" y="{MARGIN + 15 * i}" fill="{colour}">{label}</text>')
+
+    out.append("</svg>")
+    return "\n".join(out)
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: plot_pareto.py results.csv [output directory]")
+        sys.exit(1)
+
+    directory = sys.argv[2] if len(sys.argv) > 2 else "bin"
+    os.makedirs(directory, exist_ok=True)
+
+    # problem -> method -> [(evaluations, time, error)]
+    runs = defaultdict(lambda: defaultdict(list))
+    with open(sys.argv[1]) as file:
+        for row in csv.DictReader(file):
+            method = row["method"]
+            if row["method"] not in ("qag", "qags"):
+                method += f" ({row['threads']} threads)"
+            error = max(float(row["error"]), FLOOR)
+            runs[row["problem"]][method].append(
+                (int(row["evaluations"]), max(float(row["time"]), 1e-6), error))
+
+    for problem, methods in runs.items():
+        for name, index, label in (("evaluations", 0, "function evaluations"), ("time", 1, "time (s)")):
+            series = {m: [(p[index], p[2]) for p in points] for m, points in methods.items()}
+            path = os.path.join(directory, f"pareto_{problem}_{name}.svg")
+            with open(path, "w") as file:
+                file.write(chart(f"{problem}: error against {name}", label, series))
+            print(path)
+
+
+if __name__ == "__main__":
+    main()
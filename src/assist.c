@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "assist.h"
+
+enum {
+    ASSIST_EMPTY,   // nothing offered
+    ASSIST_POSTED,  // points offered, no helper yet
+    ASSIST_CLAIMED, // a helper is evaluating the points
+    ASSIST_DONE     // helper has written the function values
+};
+
+bool assist_enabled(void)
+{
+    const char *setting = getenv("SOLVER_ASSIST");
+    return !(setting && atoi(setting) == 0);
+}
+
+// initialise help slot
+void assist_init(struct Assist *slot)
+{
+    slot->integrand = NULL;
+    slot->n = 0;
+    slot->state = ASSIST_EMPTY;
+    omp_init_lock(&slot->lock);
+}
+
+// terminate help slot
+void assist_destroy(struct Assist *slot)
+{
+    omp_destroy_lock(&slot->lock);
+}
+
+void assist_eval(struct Assist *slot, struct Idle *idle, const struct Integrand *integrand,
+                 const double *x, double *fx, int n, bool share)
+{
+    assert(slot && idle && integrand);
+
+    int offered = share ? n / 2 : 0;
+    if (offered > ASSIST_MAXBATCH)
+        offered = ASSIST_MAXBATCH;
+
+    if (offered == 0) {
+        integrand->eval(x, fx, n, integrand->data);
+        return;
+    }
+
+    // Offer the tail of the batch and evaluate the head ourselves
+    int kept = n - offered;
+
+    omp_set_lock(&slot->lock);
+    {
+        slot->integrand = integrand;
+        memcpy(slot->x, x + kept, offered * sizeof(double));
+        slot->n = offered;
+        slot->state = ASSIST_POSTED;
+    }
+    omp_unset_lock(&slot->lock);
+
+    integrand->eval(x, fx, kept, integrand->data);
+
+    // Take the offer back if nobody has picked it up in the meantime
+    bool revoked = false;
+    omp_set_lock(&slot->lock);
+    {
+        if (slot->state == ASSIST_POSTED) {
+            slot->state = ASSIST_EMPTY;
+            revoked = true;
+        }
+    }
+    omp_unset_lock(&slot->lock);
+
+    if (revoked) {
+        integrand->eval(x + kept, fx + kept, offered, integrand->data);
+        return;
+    }
+
+    // A helper is evaluating the offered points, wait for it to finish
+    while (1) {
+        int state;
+        #pragma omp atomic read
+        state = slot->state;
+
+        if (state == ASSIST_DONE)
+            break;
+
+        idle_pause(idle);
+    }
+
+    omp_set_lock(&slot->lock);
+    {
+        memcpy(fx + kept, slot->fx, offered * sizeof(double));
+        slot->state = ASSIST_EMPTY;
+    }
+    omp_unset_lock(&slot->lock);
+}
+
+bool assist_help(struct Assist *slots, int count, int self)
+{
+    assert(slots);
+
+    for (int attempt = 1; attempt < count; ++attempt) {
+        struct Assist *slot = &slots[(self + attempt) % count];
+
+        int state;
+        #pragma omp atomic read
+        state = slot->state;
+
+        if (state != ASSIST_POSTED)
+            continue;
+
+        // Claim the offer. If the slot is locked its owner is either posting
+        // or revoking, so try the next one.
+        bool claimed = false;
+        if (omp_test_lock(&slot->lock)) {
+            if (slot->state == ASSIST_POSTED) {
+                slot->state = ASSIST_CLAIMED;
+                claimed = true;
+            }
+            omp_unset_lock(&slot->lock);
+        }
+
+        if (!claimed)
+            continue;
+
+        // The owner does not touch x and fx until the state becomes DONE
+        slot->integrand->eval(slot->x, slot->fx, slot->n, slot->integrand->data);
+
+        omp_set_lock(&slot->lock);
+        slot->state = ASSIST_DONE;
+        omp_unset_lock(&slot->lock);
+
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,40 @@
+#ifndef ASSIST_H
+#define ASSIST_H
+
+#include <stdbool.h>
+#include <omp.h>
+
+#include "function.h"
+#include "idle.h"
+
+// Largest batch of abscissae that can be offered to another thread
+#define ASSIST_MAXBATCH 8
+
+// Help slot owned by a single thread. When only a few intervals are left, a
+// thread evaluating an interval offers part of its batch in its slot so that an
+// idle thread can evaluate it at the same time.
+struct Assist {
+    const struct Integrand *integrand; // integrand of the offered points
+    double x[ASSIST_MAXBATCH];         // offered abscissae
+    double fx[ASSIST_MAXBATCH];        // function values written by the helper
+    int n;                             // number of offered points
+    int state;                         // ASSIST_EMPTY, ASSIST_POSTED, ...
+    omp_lock_t lock;                   // Slot lock
+};
+
+// Whether idle threads help at all, which SOLVER_ASSIST=0 turns off
+bool assist_enabled(void);
+
+void assist_init(struct Assist *);
+void assist_destroy(struct Assist *);
+
+// Evaluate a batch, offering the second half to idle threads when share is set.
+// Waiting for a helper follows the idle mode.
+void assist_eval(struct Assist *, struct Idle *, const struct Integrand *, const double *, double *, int,
+                 bool share);
+
+// Evaluate the points offered in another thread's slot. Returns whether any
+// work was done.
+bool assist_help(struct Assist *slots, int count, int self);
+
+#endif
@@ -0,0 +1,150 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "async.h"
+#include "function.h"
+
+void async_server_init(struct AsyncServer *server, int workers, int capacity, double latency, int slots)
+{
+    assert(server && workers > 0 && capacity > 0 && latency >= 0.0 && slots > 0);
+
+    server->latency = latency;
+    server->slots = slots;
+    server->next = 0;
+    server->requests = 0;
+    server->workers = workers;
+    server->capacity = capacity;
+
+    server->free_at = (double *)malloc(sizeof(double) * slots);
+    server->channels = (struct AsyncChannel *)malloc(sizeof(struct AsyncChannel) * workers);
+    if (!server->free_at || !server->channels) {
+        printf("Failed to allocate server - exiting\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < slots; ++i) {
+        server->free_at[i] = 0.0;
+    }
+
+    for (int i = 0; i < workers; ++i) {
+        struct AsyncChannel *channel = &server->channels[i];
+
+        channel->request = (struct AsyncRequest *)malloc(sizeof(struct AsyncRequest) * capacity);
+        if (!channel->request) {
+            printf("Failed to allocate server - exiting\n");
+            exit(1);
+        }
+        channel->head = 0;
+        channel->count = 0;
+        channel->blocked = 0.0;
+    }
+
+    omp_init_lock(&server->lock);
+}
+
+void async_server_destroy(struct AsyncServer *server)
+{
+    for (int i = 0; i < server->workers; ++i) {
+        free(server->channels[i].request);
+    }
+
+    free(server->channels);
+    free(server->free_at);
+    omp_destroy_lock(&server->lock);
+}
+
+static void server_submit(int worker, double x, long tag, void *data)
+{
+    struct AsyncServer *server = (struct AsyncServer *)data;
+    struct AsyncChannel *channel = &server->channels[worker];
+
+    if (channel->count == server->capacity) {
+        printf("Maximum outstanding requests exceeded - exiting\n");
+        exit(1);
+    }
+
+    double now = omp_get_wtime();
+    double start;
+
+    // Serve the request on the slot that is freed next, as soon as it is free
+    omp_set_lock(&server->lock);
+    {
+        double free_at = server->free_at[server->next];
+        start = (free_at > now) ? free_at : now;
+
+        server->free_at[server->next] = start + server->latency;
+        server->next = (server->next + 1) % server->slots;
+        server->requests++;
+    }
+    omp_unset_lock(&server->lock);
+
+    struct AsyncRequest *request = &channel->request[(channel->head + channel->count) % server->capacity];
+    request->x = x;
+    request->tag = tag;
+    request->ready = start + server->latency;
+    channel->count++;
+}
+
+static int server_poll(int worker, struct Completion *done, int max, bool wait, void *data)
+{
+    struct AsyncServer *server = (struct AsyncServer *)data;
+    struct AsyncChannel *channel = &server->channels[worker];
+
+    if (wait && channel->count == 0) {
+        printf("Waiting for a server reply with none outstanding - exiting\n");
+        exit(1);
+    }
+
+    double now = omp_get_wtime();
+
+    if (wait && channel->request[channel->head].ready > now) {
+        // Sleep until the oldest request is answered
+        double delay = channel->request[channel->head].ready - now;
+        struct timespec sleep = { (time_t)delay, (long)((delay - (time_t)delay) * 1e9) };
+        nanosleep(&sleep, NULL);
+
+        double woken = omp_get_wtime();
+        channel->blocked += woken - now;
+        now = woken;
+
+        // A short sleep can return early, the request is then taken as answered
+        if (channel->request[channel->head].ready > now)
+            now = channel->request[channel->head].ready;
+    }
+
+    int n = 0;
+    while (n < max && channel->count > 0 && channel->request[channel->head].ready <= now) {
+        struct AsyncRequest *request = &channel->request[channel->head];
+
+        done[n].tag = request->tag;
+        done[n].fx = func1(request->x);
+        n++;
+
+        channel->head = (channel->head + 1) % server->capacity;
+        channel->count--;
+    }
+
+    return n;
+}
+
+struct AsyncIntegrand async_server_integrand(struct AsyncServer *server)
+{
+    struct AsyncIntegrand integrand = { server_submit, server_poll, server, FUNC1_NOISE };
+    return integrand;
+}
+
+double async_server_blocked(struct AsyncServer *server)
+{
+    double blocked = 0.0;
+
+    for (int i = 0; i < server->workers; ++i) {
+        blocked += server->channels[i].blocked;
+    }
+
+    return blocked;
+}
@@ -0,0 +1,73 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <stdbool.h>
+#include <omp.h>
+
+// Finished evaluation of an asynchronous integrand
+struct Completion {
+    long tag;  // tag given to submit
+    double fx; // function value
+};
+
+// Integrand whose values arrive some time after they are requested, such as
+// one answered by a model server or read from storage. Workers are numbered
+// from 0 and each polls only for its own evaluations, so an implementation can
+// keep one channel per worker and only synchronise what they share.
+struct AsyncIntegrand {
+    // Request the value at x on behalf of worker, returned later with tag
+    void (*submit)(int worker, double x, long tag, void *data);
+
+    // Store up to max finished evaluations of worker in done and return how
+    // many were stored. With wait set it blocks until at least one is
+    // finished, which requires one to be outstanding.
+    int (*poll)(int worker, struct Completion *done, int max, bool wait, void *data);
+
+    void *data;
+    double noise; // relative error of the values as for struct Integrand
+};
+
+struct AsyncRequest {
+    double x;
+    long tag;
+    double ready; // omp_get_wtime at which the value is available
+};
+
+// Requests of one worker in the order they finish
+struct AsyncChannel {
+    struct AsyncRequest *request; // ring of capacity requests
+    int head;
+    int count;
+    double blocked;               // seconds spent waiting in poll
+};
+
+// Stand-in for a local model server answering func1. It serves slots requests
+// at a time, each taking latency seconds, and queues the rest in the order
+// they arrive. Since every request takes the same time they also finish in
+// that order, so the slot freed next is always the following one in turn and
+// each worker's requests finish in the order it submitted them. No thread
+// runs behind it: a value is computed by the worker polling for it once its
+// time has come, and a waiting worker sleeps so that its core is free.
+struct AsyncServer {
+    double latency;               // seconds per request
+    int slots;                    // requests served at once
+    double *free_at;              // time each slot becomes free
+    int next;                     // slot freed next
+    long requests;                // requests received
+    omp_lock_t lock;              // protects free_at, next and requests
+
+    int workers;
+    int capacity;                 // outstanding requests per worker
+    struct AsyncChannel *channels;
+};
+
+void async_server_init(struct AsyncServer *, int workers, int capacity, double latency, int slots);
+void async_server_destroy(struct AsyncServer *);
+
+// Asynchronous integrand of func1 answered by the server
+struct AsyncIntegrand async_server_integrand(struct AsyncServer *);
+
+// Seconds the workers spent blocked waiting for the server, summed over them
+double async_server_blocked(struct AsyncServer *);
+
+#endif
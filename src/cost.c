@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "cost.h"
+
+bool cost_mode_parse(const struct Integrand *integrand, enum CostMode *mode)
+{
+    const char *setting = getenv("SOLVER_COST");
+
+    if (!setting) {
+        *mode = integrand->cost ? COST_STATIC : COST_NONE;
+        return true;
+    }
+    if (strcmp(setting, "none") == 0) {
+        *mode = COST_NONE;
+        return true;
+    }
+    if (strcmp(setting, "static") == 0 && integrand->cost) {
+        *mode = COST_STATIC;
+        return true;
+    }
+    if (strcmp(setting, "learned") == 0) {
+        *mode = COST_LEARNED;
+        return true;
+    }
+
+    return false;
+}
+
+enum CostMode cost_mode_from_env(const struct Integrand *integrand)
+{
+    enum CostMode mode;
+
+    if (!cost_mode_parse(integrand, &mode)) {
+        const char *setting = getenv("SOLVER_COST");
+
+        if (strcmp(setting, "static") == 0)
+            printf("SOLVER_COST=static needs an integrand with a cost hook - exiting\n");
+        else
+            printf("Unknown SOLVER_COST mode '%s' - exiting\n", setting);
+        exit(1);
+    }
+
+    return mode;
+}
+
+void cost_init(struct CostModel *model, const struct Integrand *integrand, double left, double right)
+{
+    assert(model && integrand);
+
+    // An invalid SOLVER_COST was already rejected by the caller, the library
+    // must not exit on it
+    model->mode = integrand->cost ? COST_STATIC : COST_NONE;
+    cost_mode_parse(integrand, &model->mode);
+    model->integrand = integrand;
+    model->left = left;
+    model->width = (right - left) / COST_BINS;
+
+    for (int i = 0; i < COST_BINS; ++i) {
+        model->time[i] = 0.0;
+        model->count[i] = 0;
+    }
+}
+
+static int bin(struct CostModel *model, double x)
+{
+    int i = (model->width > 0.0) ? (int)((x - model->left) / model->width) : 0;
+    return (i < 0) ? 0 : (i >= COST_BINS) ? COST_BINS - 1 : i;
+}
+
+// Mean measured time of an evaluation in the bin of x. Bins not measured yet
+// take the nearest measured bin, or 1 if there is none.
+static double learned(struct CostModel *model, double x)
+{
+    int centre = bin(model, x);
+
+    for (int offset = 0; offset < COST_BINS; ++offset) {
+        for (int side = -1; side <= 1; side += 2) {
+            int i = centre + side * offset;
+            if (i < 0 || i >= COST_BINS)
+                continue;
+
+            long count;
+            double time;
+            #pragma omp atomic read
+            count = model->count[i];
+            #pragma omp atomic read
+            time = model->time[i];
+
+            if (count > 0)
+                return time / count;
+        }
+    }
+
+    return 1.0;
+}
+
+double cost_estimate(struct CostModel *model, double left, double right)
+{
+    double mid = (left + right) / 2.0;
+
+    switch (model->mode) {
+    case COST_STATIC:
+        return (right - left) * model->integrand->cost(mid, model->integrand->data);
+    case COST_LEARNED:
+        return (right - left) * learned(model, mid);
+    default:
+        return 0.0;
+    }
+}
+
+void cost_record(struct CostModel *model, double x, int n, double seconds)
+{
+    if (model->mode != COST_LEARNED)
+        return;
+
+    int i = bin(model, x);
+
+    #pragma omp atomic
+    model->time[i] += seconds;
+    #pragma omp atomic
+    model->count[i] += n;
+}
+
+void cost_report(enum CostMode mode, FILE *out)
+{
+    static const char *names[] = { "none", "static", "learned" };
+
+    fprintf(out, "Cost model = %s\n", names[mode]);
+}
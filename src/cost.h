@@ -0,0 +1,50 @@
+#ifndef COST_H
+#define COST_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "function.h"
+
+// How the cost of intervals is estimated. Selected with the SOLVER_COST
+// environment variable.
+enum CostMode {
+    COST_NONE,    // no estimate, queues are plain LIFO stacks
+    COST_STATIC,  // the integrand's cost hook (default when it has one)
+    COST_LEARNED  // evaluation times measured during the run
+};
+
+// Bins over the domain in which evaluation times are learned
+#define COST_BINS 256
+
+struct CostModel {
+    enum CostMode mode;
+    const struct Integrand *integrand;
+    double left;              // start of the domain
+    double width;             // width of a bin
+    double time[COST_BINS];   // measured seconds of evaluations in each bin
+    long count[COST_BINS];    // evaluations timed in each bin
+};
+
+// Store the mode SOLVER_COST selects for the integrand in mode, or its default
+// if SOLVER_COST is not set. Returns false and leaves mode unchanged if the
+// value is not a valid mode for the integrand.
+bool cost_mode_parse(const struct Integrand *, enum CostMode *mode);
+
+// The mode SOLVER_COST selects, exiting if it is not valid. Called by main
+// before integrating, as integrate falls back to the default mode instead.
+enum CostMode cost_mode_from_env(const struct Integrand *);
+
+void cost_init(struct CostModel *, const struct Integrand *, double left, double right);
+
+// Estimated cost of refining [left, right] down to the tolerance, taken as
+// its width times the cost of an evaluation at its midpoint. Only the order of
+// the estimates matters.
+double cost_estimate(struct CostModel *, double left, double right);
+
+// Record that n evaluations around x took the given time
+void cost_record(struct CostModel *, double x, int n, double seconds);
+
+void cost_report(enum CostMode, FILE *);
+
+#endif
@@ -0,0 +1,115 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "counters.h"
+
+// L2_RQSTS.MISS on Broadwell and Skylake
+#define COUNTERS_L2_DEFAULT 0x3f24
+
+static const char *names[COUNTERS_EVENTS] = { "L1D read misses", "L2 misses" };
+
+void counters_init(struct Counters *counters)
+{
+    assert(counters);
+
+    counters->enabled = (getenv("SOLVER_COUNTERS") != NULL);
+
+    const char *l2 = getenv("SOLVER_COUNTERS_L2");
+    counters->l2_config = l2 ? strtoull(l2, NULL, 0) : COUNTERS_L2_DEFAULT;
+
+    for (int i = 0; i < COUNTERS_EVENTS; ++i) {
+        counters->value[i] = 0;
+    }
+    counters->threads = 0;
+}
+
+// Count an event of the calling thread in user space only, which is allowed
+// without privileges while perf_event_paranoid is at most 2
+static int open_event(unsigned int type, unsigned long long config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void counters_thread_start(struct Counters *counters, int fd[COUNTERS_EVENTS])
+{
+    for (int i = 0; i < COUNTERS_EVENTS; ++i) {
+        fd[i] = -1;
+    }
+
+    if (!counters || !counters->enabled)
+        return;
+
+    fd[0] = open_event(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    fd[1] = open_event(PERF_TYPE_RAW, counters->l2_config);
+
+    for (int i = 0; i < COUNTERS_EVENTS; ++i) {
+        if (fd[i] >= 0) {
+            ioctl(fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void counters_thread_stop(struct Counters *counters, int fd[COUNTERS_EVENTS])
+{
+    if (!counters || !counters->enabled)
+        return;
+
+    for (int i = 0; i < COUNTERS_EVENTS; ++i) {
+        long long count = -1;
+
+        if (fd[i] >= 0) {
+            ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd[i], &count, sizeof(count)) != sizeof(count))
+                count = -1;
+            close(fd[i]);
+        }
+
+        // An event that any thread could not count is unavailable
+        #pragma omp critical (counters)
+        {
+            if (count < 0 || counters->value[i] < 0)
+                counters->value[i] = -1;
+            else
+                counters->value[i] += count;
+        }
+    }
+
+    #pragma omp atomic
+    counters->threads++;
+}
+
+void counters_report(struct Counters *counters, long evaluations, FILE *out)
+{
+    if (!counters->enabled)
+        return;
+
+    for (int i = 0; i < COUNTERS_EVENTS; ++i) {
+        if (counters->value[i] < 0) {
+            fprintf(out, "%s = unavailable\n", names[i]);
+            continue;
+        }
+
+        fprintf(out, "%s = %lld\n", names[i], counters->value[i]);
+        if (evaluations > 0)
+            fprintf(out, "%s per evaluation = %f\n", names[i], (double)counters->value[i] / evaluations);
+    }
+}
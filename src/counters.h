@@ -0,0 +1,33 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// Events counted: L1 data cache read misses and L2 misses
+#define COUNTERS_EVENTS 2
+
+// Cache misses of the solver threads, counted with perf_event_open in each
+// thread while it runs the solver loop. Counting is enabled by setting
+// SOLVER_COUNTERS. The L2 event is not one of the kernel's generic events, so
+// it is given as a raw event code in SOLVER_COUNTERS_L2, by default
+// L2_RQSTS.MISS (0x3f24) on Broadwell and Skylake.
+struct Counters {
+    bool enabled;                       // SOLVER_COUNTERS is set
+    unsigned long long l2_config;       // raw event code of the L2 event
+    long long value[COUNTERS_EVENTS];   // summed over threads, -1 if unavailable
+    int threads;                        // threads that counted
+};
+
+void counters_init(struct Counters *);
+
+// Open the counters of the calling thread into fd and start them
+void counters_thread_start(struct Counters *, int fd[COUNTERS_EVENTS]);
+
+// Stop the calling thread's counters, add them to the totals and close them
+void counters_thread_stop(struct Counters *, int fd[COUNTERS_EVENTS]);
+
+// Print the misses of the run and per function evaluation
+void counters_report(struct Counters *, long evaluations, FILE *);
+
+#endif
@@ -0,0 +1,141 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <assert.h>
+
+#include "energy.h"
+
+#define POWERCAP "/sys/class/powercap"
+
+// Read a single integer from a sysfs file, returns -1 on failure
+static long long read_counter(const char *path)
+{
+    long long value = -1;
+
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return -1;
+
+    if (fscanf(file, "%lld", &value) != 1)
+        value = -1;
+
+    fclose(file);
+    return value;
+}
+
+// Add the zone in directory dir if it is a package or DRAM domain and its
+// counter can be read. Reading energy_uj usually requires root.
+static void add_zone(struct Energy *energy, const char *dir)
+{
+    char path[512], name[32];
+
+    snprintf(path, sizeof(path), POWERCAP "/%s/name", dir);
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return;
+
+    int ok = (fscanf(file, "%31s", name) == 1);
+    fclose(file);
+
+    if (!ok || (strncmp(name, "package", 7) != 0 && strcmp(name, "dram") != 0))
+        return;
+
+    int i = energy->count;
+    snprintf(energy->path[i], sizeof(energy->path[i]), POWERCAP "/%s/energy_uj", dir);
+
+    snprintf(path, sizeof(path), POWERCAP "/%s/max_energy_range_uj", dir);
+    energy->range[i] = read_counter(path);
+    energy->start[i] = read_counter(energy->path[i]);
+
+    if (energy->start[i] < 0)
+        return;
+
+    strcpy(energy->name[i], name);
+    energy->joules[i] = 0.0;
+    energy->count++;
+}
+
+void energy_start(struct Energy *energy)
+{
+    assert(energy);
+
+    energy->count = 0;
+
+    DIR *dir = opendir(POWERCAP);
+    if (!dir)
+        return;
+
+    // Top level zones are packages, their sub-zones include DRAM. Other
+    // powercap drivers such as intel-rapl-mmio duplicate the same domains.
+    struct dirent *entry;
+    while ((entry = readdir(dir)) && energy->count < ENERGY_MAXZONES) {
+        if (strncmp(entry->d_name, "intel-rapl:", 11) == 0)
+            add_zone(energy, entry->d_name);
+    }
+
+    closedir(dir);
+}
+
+void energy_stop(struct Energy *energy)
+{
+    assert(energy);
+
+    for (int i = 0; i < energy->count; ++i) {
+        long long end = read_counter(energy->path[i]);
+        long long used = end - energy->start[i];
+
+        // The counter wrapped around during the run
+        if (used < 0 && energy->range[i] > 0)
+            used += energy->range[i];
+
+        energy->joules[i] = (end < 0 || used < 0) ? 0.0 : used * 1.0e-6;
+    }
+}
+
+double energy_package(struct Energy *energy)
+{
+    double joules = 0.0;
+
+    for (int i = 0; i < energy->count; ++i) {
+        if (strncmp(energy->name[i], "package", 7) == 0)
+            joules += energy->joules[i];
+    }
+
+    return joules;
+}
+
+double energy_dram(struct Energy *energy)
+{
+    double joules = 0.0;
+
+    for (int i = 0; i < energy->count; ++i) {
+        if (strcmp(energy->name[i], "dram") == 0)
+            joules += energy->joules[i];
+    }
+
+    return joules;
+}
+
+void energy_report(struct Energy *energy, int integrals, long evaluations, FILE *out)
+{
+    fprintf(out, "Evaluations = %ld\n", evaluations);
+
+    if (energy->count == 0) {
+        fprintf(out, "Energy(J) = unavailable\n");
+        return;
+    }
+
+    double package = energy_package(energy);
+    double dram = energy_dram(energy);
+    double total = package + dram;
+
+    fprintf(out, "Energy package(J) = %f\n", package);
+    fprintf(out, "Energy DRAM(J) = %f\n", dram);
+    fprintf(out, "Energy(J) = %f\n", total);
+    if (integrals > 0)
+        fprintf(out, "Energy per integral(J) = %e\n", total / integrals);
+    if (evaluations > 0)
+        fprintf(out, "Energy per evaluation(J) = %e\n", total / evaluations);
+}
@@ -0,0 +1,30 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <stdio.h>
+
+// Maximum number of RAPL zones (packages and their DRAM domains) measured
+#define ENERGY_MAXZONES 16
+
+// Energy counters read from the Linux powercap interface. When no readable
+// RAPL zone exists the measurement is marked unavailable.
+struct Energy {
+    int count;                          // number of zones measured
+    char name[ENERGY_MAXZONES][32];     // zone name, e.g. package-0 or dram
+    char path[ENERGY_MAXZONES][256];    // path of the zone's energy_uj file
+    long long range[ENERGY_MAXZONES];   // counter wraps around at this value
+    long long start[ENERGY_MAXZONES];   // counter at energy_start in uJ
+    double joules[ENERGY_MAXZONES];     // energy between start and stop
+};
+
+void energy_start(struct Energy *);
+void energy_stop(struct Energy *);
+
+// Total energy of all package or dram zones in joules
+double energy_package(struct Energy *);
+double energy_dram(struct Energy *);
+
+// Print the energy of the run, per integral and per function evaluation
+void energy_report(struct Energy *, int integrals, long evaluations, FILE *);
+
+#endif
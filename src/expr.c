@@ -0,0 +1,486 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#include "expr.h"
+
+enum {
+    OP_CONST, OP_X, OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_NEG, OP_POW,
+    OP_SIN, OP_COS, OP_TAN, OP_EXP, OP_LOG, OP_SQRT, OP_ABS, OP_FLOOR, OP_EULER
+};
+
+// Functions by name with their number of arguments
+static const struct {
+    const char *name;
+    int op;
+    int args;
+} functions[] = {
+    { "sin", OP_SIN, 1 }, { "cos", OP_COS, 1 }, { "tan", OP_TAN, 1 }, { "exp", OP_EXP, 1 },
+    { "log", OP_LOG, 1 }, { "sqrt", OP_SQRT, 1 }, { "abs", OP_ABS, 1 }, { "floor", OP_FLOOR, 1 },
+    { "pow", OP_POW, 2 }, { "euler", OP_EULER, 4 },
+};
+
+// C for each instruction, the operands are the stack slots from the deepest
+static const char *templates[] = {
+    NULL, NULL, "%s + %s", "%s - %s", "%s * %s", "%s / %s", "-%s", "pow(%s, %s)",
+    "sin(%s)", "cos(%s)", "tan(%s)", "exp(%s)", "log(%s)", "sqrt(%s)", "fabs(%s)", "floor(%s)",
+    "euler(%s, %s, %s, (int) (%s))"
+};
+
+// Values an instruction pops from the stack
+static int arguments(int op)
+{
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        if (functions[i].op == op)
+            return functions[i].args;
+    }
+
+    if (op == OP_CONST || op == OP_X)
+        return 0;
+    return (op == OP_NEG) ? 1 : 2;
+}
+
+// Recursive descent parser emitting stack code
+struct Parser {
+    const char *text;
+    const char *p;
+    struct Expr *expr;
+    int depth;         // current stack depth
+    char *error;
+    size_t size;
+    bool failed;
+};
+
+static void fail(struct Parser *parser, const char *message)
+{
+    if (!parser->failed)
+        snprintf(parser->error, parser->size, "%s at position %d", message, (int)(parser->p - parser->text));
+    parser->failed = true;
+}
+
+// Append an instruction that pops pops values and pushes one
+static void emit(struct Parser *parser, int op, double value, int pops)
+{
+    struct Expr *expr = parser->expr;
+
+    if (expr->count == EXPR_MAXCODE) {
+        fail(parser, "expression too long");
+        return;
+    }
+
+    expr->code[expr->count].op = op;
+    expr->code[expr->count].value = value;
+    expr->count++;
+
+    parser->depth += 1 - pops;
+    if (parser->depth > EXPR_MAXSTACK)
+        fail(parser, "expression nested too deeply");
+    if (parser->depth > expr->depth)
+        expr->depth = parser->depth;
+}
+
+static void skip(struct Parser *parser)
+{
+    while (isspace((unsigned char)*parser->p))
+        parser->p++;
+}
+
+static bool accept(struct Parser *parser, char c)
+{
+    skip(parser);
+    if (*parser->p != c)
+        return false;
+
+    parser->p++;
+    return true;
+}
+
+static void sum(struct Parser *);
+static void unary(struct Parser *);
+
+static void primary(struct Parser *parser)
+{
+    skip(parser);
+
+    if (accept(parser, '(')) {
+        sum(parser);
+        if (!accept(parser, ')'))
+            fail(parser, "expected )");
+        return;
+    }
+
+    if (isdigit((unsigned char)*parser->p) || *parser->p == '.') {
+        char *end;
+        double value = strtod(parser->p, &end);
+        if (end == parser->p) {
+            fail(parser, "invalid number");
+            return;
+        }
+        parser->p = end;
+        emit(parser, OP_CONST, value, 0);
+        return;
+    }
+
+    if (!isalpha((unsigned char)*parser->p)) {
+        fail(parser, "expected a number, x or a function");
+        return;
+    }
+
+    const char *start = parser->p;
+    while (isalnum((unsigned char)*parser->p) || *parser->p == '_')
+        parser->p++;
+    size_t length = (size_t)(parser->p - start);
+
+    if (length == 1 && *start == 'x') {
+        emit(parser, OP_X, 0.0, 0);
+        return;
+    }
+    if (length == 2 && strncmp(start, "pi", 2) == 0) {
+        emit(parser, OP_CONST, 3.14159265358979323846, 0);
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        if (strlen(functions[i].name) != length || strncmp(start, functions[i].name, length) != 0)
+            continue;
+
+        if (!accept(parser, '(')) {
+            fail(parser, "expected (");
+            return;
+        }
+        for (int arg = 0; arg < functions[i].args; arg++) {
+            if (arg > 0 && !accept(parser, ',')) {
+                fail(parser, "expected ,");
+                return;
+            }
+            sum(parser);
+        }
+        if (!accept(parser, ')')) {
+            fail(parser, "expected )");
+            return;
+        }
+
+        emit(parser, functions[i].op, 0.0, functions[i].args);
+        return;
+    }
+
+    parser->p = start;
+    fail(parser, "unknown name");
+}
+
+// Exponents are right associative and bind tighter than a leading minus
+static void power(struct Parser *parser)
+{
+    primary(parser);
+
+    if (accept(parser, '^')) {
+        unary(parser);
+        emit(parser, OP_POW, 0.0, 2);
+    }
+}
+
+static void unary(struct Parser *parser)
+{
+    if (accept(parser, '-')) {
+        unary(parser);
+        emit(parser, OP_NEG, 0.0, 1);
+    } else {
+        accept(parser, '+');
+        power(parser);
+    }
+}
+
+static void product(struct Parser *parser)
+{
+    unary(parser);
+
+    while (!parser->failed) {
+        if (accept(parser, '*')) {
+            unary(parser);
+            emit(parser, OP_MUL, 0.0, 2);
+        } else if (accept(parser, '/')) {
+            unary(parser);
+            emit(parser, OP_DIV, 0.0, 2);
+        } else {
+            break;
+        }
+    }
+}
+
+static void sum(struct Parser *parser)
+{
+    product(parser);
+
+    while (!parser->failed) {
+        if (accept(parser, '+')) {
+            product(parser);
+            emit(parser, OP_ADD, 0.0, 2);
+        } else if (accept(parser, '-')) {
+            product(parser);
+            emit(parser, OP_SUB, 0.0, 2);
+        } else {
+            break;
+        }
+    }
+}
+
+// Generate C for the stack code, one local per instruction, and build it into
+// a shared object. Returns false if any step fails.
+static bool compile_native(struct Expr *expr)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    char source[512], object[600], command[2048];
+    snprintf(source, sizeof(source), "%s/solverexprXXXXXX", tmpdir ? tmpdir : "/tmp");
+
+    int fd = mkstemp(source);
+    if (fd < 0)
+        return false;
+
+    FILE *file = fdopen(fd, "w");
+    if (!file) {
+        close(fd);
+        unlink(source);
+        return false;
+    }
+
+    // The same Euler loop as function.c so that results match func1
+    fprintf(file, "#include <math.h>\n\n"
+                  "static double euler(double init, double step, double alpha, int numsteps)\n"
+                  "{\n"
+                  "  double y = init;\n"
+                  "  for (int i = 0; i < numsteps; i++) {\n"
+                  "    y += step * (alpha - y);\n"
+                  "  }\n"
+                  "  return y;\n"
+                  "}\n\n"
+                  "void expr_batch(const double *x, double *fx, int n, void *data)\n"
+                  "{\n"
+                  "  (void) data;\n"
+                  "  for (int i = 0; i < n; i++) {\n");
+
+    // Each value is a local named after the instruction that computed it
+    int slot[EXPR_MAXSTACK];
+    int depth = 0;
+    for (int k = 0; k < expr->count; k++) {
+        const struct ExprOp *op = &expr->code[k];
+
+        if (op->op == OP_CONST) {
+            fprintf(file, "    double t%d = %a;\n", k, op->value);
+        } else if (op->op == OP_X) {
+            fprintf(file, "    double t%d = x[i];\n", k);
+        } else {
+            char names[4][16];
+            int args = arguments(op->op);
+
+            depth -= args;
+            for (int arg = 0; arg < args; arg++) {
+                snprintf(names[arg], sizeof(names[arg]), "t%d", slot[depth + arg]);
+            }
+
+            fprintf(file, "    double t%d = ", k);
+            fprintf(file, templates[op->op], names[0], names[1], names[2], names[3]);
+            fprintf(file, ";\n");
+        }
+
+        slot[depth++] = k;
+    }
+
+    fprintf(file, "    fx[i] = t%d;\n  }\n}\n", expr->count - 1);
+    fclose(file);
+
+    const char *cc = getenv("SOLVER_JIT_CC");
+    snprintf(object, sizeof(object), "%s.so", source);
+    snprintf(command, sizeof(command), "%s -fPIC -shared -x c %s -o %s -lm > /dev/null 2>&1",
+             cc ? cc : "cc -O3", source, object);
+
+    int status = system(command);
+    unlink(source);
+    if (status != 0) {
+        unlink(object);
+        return false;
+    }
+
+    // The object can be removed once it is mapped
+    expr->handle = dlopen(object, RTLD_NOW | RTLD_LOCAL);
+    unlink(object);
+    if (!expr->handle)
+        return false;
+
+    *(void **)(&expr->native) = dlsym(expr->handle, "expr_batch");
+    if (!expr->native) {
+        dlclose(expr->handle);
+        expr->handle = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool expr_compile(struct Expr *expr, const char *text, bool native, char *error, size_t size)
+{
+    assert(expr && text && error);
+
+    expr->backend = EXPR_BYTECODE;
+    expr->count = 0;
+    expr->depth = 0;
+    expr->native = NULL;
+    expr->handle = NULL;
+
+    struct Parser parser = { text, text, expr, 0, error, size, false };
+    sum(&parser);
+    skip(&parser);
+    if (!parser.failed && *parser.p != '\0')
+        fail(&parser, "unexpected character");
+    if (parser.failed)
+        return false;
+
+    if (native && compile_native(expr))
+        expr->backend = EXPR_NATIVE;
+
+    return true;
+}
+
+void expr_destroy(struct Expr *expr)
+{
+    if (expr->handle)
+        dlclose(expr->handle);
+
+    expr->handle = NULL;
+    expr->native = NULL;
+}
+
+// Run the code for up to EXPR_BATCH points, every instruction looping over
+// all of them so that the dispatch is paid once per batch
+static void interpret(const struct Expr *expr, const double *x, double *fx, int n)
+{
+    double stack[EXPR_MAXSTACK][EXPR_BATCH];
+    int numsteps[EXPR_BATCH];
+    int top = -1;
+
+    for (int k = 0; k < expr->count; k++) {
+        const struct ExprOp *op = &expr->code[k];
+        double *r = (top >= 0) ? stack[top] : NULL;
+
+        switch (op->op) {
+        case OP_CONST:
+            top++;
+            for (int i = 0; i < n; i++) stack[top][i] = op->value;
+            break;
+        case OP_X:
+            top++;
+            for (int i = 0; i < n; i++) stack[top][i] = x[i];
+            break;
+        case OP_ADD:
+            top--;
+            for (int i = 0; i < n; i++) stack[top][i] += r[i];
+            break;
+        case OP_SUB:
+            top--;
+            for (int i = 0; i < n; i++) stack[top][i] -= r[i];
+            break;
+        case OP_MUL:
+            top--;
+            for (int i = 0; i < n; i++) stack[top][i] *= r[i];
+            break;
+        case OP_DIV:
+            top--;
+            for (int i = 0; i < n; i++) stack[top][i] /= r[i];
+            break;
+        case OP_POW:
+            top--;
+            for (int i = 0; i < n; i++) stack[top][i] = pow(stack[top][i], r[i]);
+            break;
+        case OP_NEG:
+            for (int i = 0; i < n; i++) r[i] = -r[i];
+            break;
+        case OP_SIN:
+            for (int i = 0; i < n; i++) r[i] = sin(r[i]);
+            break;
+        case OP_COS:
+            for (int i = 0; i < n; i++) r[i] = cos(r[i]);
+            break;
+        case OP_TAN:
+            for (int i = 0; i < n; i++) r[i] = tan(r[i]);
+            break;
+        case OP_EXP:
+            for (int i = 0; i < n; i++) r[i] = exp(r[i]);
+            break;
+        case OP_LOG:
+            for (int i = 0; i < n; i++) r[i] = log(r[i]);
+            break;
+        case OP_SQRT:
+            for (int i = 0; i < n; i++) r[i] = sqrt(r[i]);
+            break;
+        case OP_ABS:
+            for (int i = 0; i < n; i++) r[i] = fabs(r[i]);
+            break;
+        case OP_FLOOR:
+            for (int i = 0; i < n; i++) r[i] = floor(r[i]);
+            break;
+        case OP_EULER:
+            top -= 3;
+            for (int i = 0; i < n; i++)
+                numsteps[i] = (int) stack[top + 3][i];
+            euler_batch(stack[top], stack[top + 1], stack[top + 2], numsteps, stack[top], n);
+            break;
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+        fx[i] = stack[0][i];
+}
+
+void expr_eval(const double *x, double *fx, int n, void *data)
+{
+    const struct Expr *expr = (const struct Expr *)data;
+
+    if (expr->backend == EXPR_NATIVE) {
+        expr->native(x, fx, n, NULL);
+        return;
+    }
+
+    for (int i = 0; i < n; i += EXPR_BATCH) {
+        interpret(expr, &x[i], &fx[i], (n - i < EXPR_BATCH) ? n - i : EXPR_BATCH);
+    }
+}
+
+void expr_integrand(struct Expr *expr, struct Integrand *integrand)
+{
+    const char *noise = getenv("SOLVER_NOISE");
+
+    integrand->eval = (expr->backend == EXPR_NATIVE) ? expr->native : expr_eval;
+    integrand->data = expr;
+    integrand->breaks = NULL;
+    integrand->nbreaks = 0;
+    integrand->breakpoints = NULL;
+    integrand->noise = noise ? atof(noise) : 0.0;
+    integrand->cost = NULL;
+}
+
+bool expr_from_env(struct Expr *expr, struct Integrand *integrand)
+{
+    const char *text = getenv("SOLVER_EXPR");
+    if (!text)
+        return false;
+
+    const char *jit = getenv("SOLVER_JIT");
+    char error[256];
+
+    if (!expr_compile(expr, text, !jit || atoi(jit) != 0, error, sizeof(error))) {
+        printf("Invalid SOLVER_EXPR: %s - exiting\n", error);
+        exit(1);
+    }
+
+    printf("Integrand: %s\n", text);
+    printf("Expression backend: %s\n", (expr->backend == EXPR_NATIVE) ? "native" : "bytecode");
+
+    expr_integrand(expr, integrand);
+    return true;
+}
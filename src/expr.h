@@ -0,0 +1,61 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "function.h"
+
+// Points the interpreter evaluates per instruction
+#define EXPR_BATCH 64
+
+// Instructions and stack depth of an expression
+#define EXPR_MAXCODE 256
+#define EXPR_MAXSTACK 32
+
+enum ExprBackend { EXPR_NATIVE, EXPR_BYTECODE };
+
+struct ExprOp {
+    int op;       // instruction, see expr.c
+    double value; // constant pushed by a constant instruction
+};
+
+// Integrand given as an expression in x, such as func1:
+//
+//     euler(0, 0.0001, 100000 * sin(x * 100000), 200 * x)
+//
+// with + - * / ^, the functions sin cos tan exp log sqrt abs floor pow and
+// euler(init, step, alpha, numsteps), which runs numsteps (truncated to an
+// int) explicit Euler steps of y' = alpha - y from y = init like func1. The
+// expression is parsed into stack code, and then either compiled to a shared
+// object with the C compiler and loaded, or run by an interpreter that
+// executes each instruction for a batch of points at once.
+struct Expr {
+    enum ExprBackend backend;
+    int count;                     // instructions in code
+    int depth;                     // stack depth needed
+    struct ExprOp code[EXPR_MAXCODE];
+
+    void (*native)(const double *, double *, int, void *);
+    void *handle;                  // dlopen handle of the native code
+};
+
+// Parse text and, if native, compile it with the compiler in SOLVER_JIT_CC
+// ("cc -O3" by default), falling back to the interpreter if that fails.
+// Returns false and describes the problem in error if text is not a valid
+// expression.
+bool expr_compile(struct Expr *, const char *text, bool native, char *error, size_t size);
+void expr_destroy(struct Expr *);
+
+// Batch evaluation of the expression in data, a struct Expr
+void expr_eval(const double *x, double *fx, int n, void *data);
+
+// Use the expression as the integrand. The error of its values is not known,
+// so noise is 0 (DBL_EPSILON) unless SOLVER_NOISE sets it.
+void expr_integrand(struct Expr *, struct Integrand *);
+
+// Replace integrand by the expression in SOLVER_EXPR if it is set, compiled
+// natively unless SOLVER_JIT=0. Exits if the expression is not valid.
+bool expr_from_env(struct Expr *, struct Integrand *);
+
+#endif
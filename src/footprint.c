@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/resource.h>
+#include <omp.h>
+
+#include "footprint.h"
+
+// Time between frontier samples at the start of a run
+#define FOOTPRINT_PERIOD 0.001
+
+void footprint_init(struct Footprint *footprint, int queues, int capacity, size_t interval_bytes)
+{
+    assert(footprint && queues > 0);
+
+    footprint->queues = queues;
+    footprint->capacity = capacity;
+    footprint->interval_bytes = interval_bytes;
+    footprint->allocated = 0;
+    footprint->high_water = (int *)calloc(queues, sizeof(int));
+    if (!footprint->high_water) {
+        printf("Failed to allocate high-water marks - exiting\n");
+        exit(1);
+    }
+
+    footprint->start = omp_get_wtime();
+    footprint->period = FOOTPRINT_PERIOD;
+    footprint->next = footprint->start;
+    footprint->sampling = 0;
+    footprint->peak_frontier = 0;
+    footprint->count = 0;
+}
+
+void footprint_destroy(struct Footprint *footprint)
+{
+    free(footprint->high_water);
+    footprint->high_water = NULL;
+}
+
+void footprint_alloc(struct Footprint *footprint, size_t bytes)
+{
+    if (!footprint)
+        return;
+
+    #pragma omp atomic
+    footprint->allocated += bytes;
+}
+
+void footprint_push(struct Footprint *footprint, int queue, int size)
+{
+    if (footprint && size > footprint->high_water[queue])
+        footprint->high_water[queue] = size;
+}
+
+bool footprint_claim(struct Footprint *footprint)
+{
+    if (!footprint)
+        return false;
+
+    double next;
+    #pragma omp atomic read
+    next = footprint->next;
+    if (omp_get_wtime() < next)
+        return false;
+
+    // Only the thread that sets the flag takes the sample
+    int sampling;
+    #pragma omp atomic capture seq_cst
+    { sampling = footprint->sampling; footprint->sampling = 1; }
+    if (sampling)
+        return false;
+
+    // The sample may have been taken since next was read
+    if (omp_get_wtime() < footprint->next) {
+        #pragma omp atomic write seq_cst
+        footprint->sampling = 0;
+        return false;
+    }
+
+    return true;
+}
+
+void footprint_sample(struct Footprint *footprint, int frontier)
+{
+    double now = omp_get_wtime();
+
+    // Keep every other sample and halve the sampling rate once full, so a run
+    // of any length is covered evenly
+    if (footprint->count == FOOTPRINT_MAXSAMPLES) {
+        for (int i = 0; i < FOOTPRINT_MAXSAMPLES / 2; ++i) {
+            footprint->samples[i] = footprint->samples[2 * i];
+        }
+        footprint->count = FOOTPRINT_MAXSAMPLES / 2;
+        footprint->period *= 2.0;
+    }
+
+    footprint->samples[footprint->count].time = now - footprint->start;
+    footprint->samples[footprint->count].frontier = frontier;
+    footprint->count++;
+    if (frontier > footprint->peak_frontier)
+        footprint->peak_frontier = frontier;
+
+    #pragma omp atomic write
+    footprint->next = now + footprint->period;
+
+    #pragma omp atomic write seq_cst
+    footprint->sampling = 0;
+}
+
+long footprint_peak_rss(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+
+    // ru_maxrss is in kilobytes on Linux
+    return usage.ru_maxrss * 1024L;
+}
+
+static int max_high_water(struct Footprint *footprint)
+{
+    int high = 0;
+    for (int i = 0; i < footprint->queues; ++i) {
+        if (footprint->high_water[i] > high)
+            high = footprint->high_water[i];
+    }
+    return high;
+}
+
+void footprint_report(struct Footprint *footprint, FILE *out)
+{
+    int high = max_high_water(footprint);
+
+    fprintf(out, "Queue high-water (max) = %d\n", high);
+    fprintf(out, "Queue high-water per queue =");
+    for (int i = 0; i < footprint->queues; ++i) {
+        fprintf(out, " %d", footprint->high_water[i]);
+    }
+    fprintf(out, "\n");
+    fprintf(out, "Queue capacity = %d\n", footprint->capacity);
+    // Memory of the queues if each was sized to the highest high-water mark
+    fprintf(out, "Queue memory needed(MB) = %f\n",
+            (double)high * footprint->interval_bytes * footprint->queues / 1048576.0);
+    fprintf(out, "Peak frontier = %d\n", footprint->peak_frontier);
+    fprintf(out, "Allocated(MB) = %f\n", footprint->allocated / 1048576.0);
+    fprintf(out, "Peak RSS(MB) = %f\n", footprint_peak_rss() / 1048576.0);
+
+    const char *threshold = getenv("SOLVER_QUEUE_WARN");
+    double warn = threshold ? atof(threshold) : FOOTPRINT_WARN;
+
+    for (int i = 0; i < footprint->queues; ++i) {
+        if (footprint->high_water[i] > warn * footprint->capacity) {
+            fprintf(out, "Warning: queue %d reached %d of %d entries\n", i, footprint->high_water[i],
+                    footprint->capacity);
+        }
+    }
+}
+
+void footprint_json(struct Footprint *footprint, const char *solver, int threads, double result, double time,
+                    long evaluations)
+{
+    const char *path = getenv("SOLVER_JSON");
+    if (!path)
+        return;
+
+    FILE *file = fopen(path, "a");
+    if (!file) {
+        printf("Failed to open %s\n", path);
+        return;
+    }
+
+    fprintf(file, "{\"solver\": \"%s\", \"threads\": %d, \"result\": %.17g, \"time\": %f, \"evaluations\": %ld, ",
+            solver, threads, result, time, evaluations);
+    fprintf(file, "\"queue_capacity\": %d, \"interval_bytes\": %zu, \"allocated_bytes\": %zu, \"peak_rss_bytes\": %ld, ",
+            footprint->capacity, footprint->interval_bytes, footprint->allocated, footprint_peak_rss());
+    fprintf(file, "\"high_water_max\": %d, \"high_water\": [", max_high_water(footprint));
+    for (int i = 0; i < footprint->queues; ++i) {
+        fprintf(file, "%s%d", i ? ", " : "", footprint->high_water[i]);
+    }
+    fprintf(file, "], \"peak_frontier\": %d, \"frontier\": [", footprint->peak_frontier);
+    for (int i = 0; i < footprint->count; ++i) {
+        fprintf(file, "%s[%f, %d]", i ? ", " : "", footprint->samples[i].time, footprint->samples[i].frontier);
+    }
+    fprintf(file, "]}\n");
+
+    fclose(file);
+}
@@ -0,0 +1,65 @@
+#ifndef FOOTPRINT_H
+#define FOOTPRINT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Frontier samples kept, older samples are thinned out once full
+#define FOOTPRINT_MAXSAMPLES 1024
+
+// Fraction of the queue capacity above which a warning is printed, unless
+// overridden by SOLVER_QUEUE_WARN
+#define FOOTPRINT_WARN 0.8
+
+struct FootprintSample {
+    double time;  // seconds since footprint_init
+    int frontier; // intervals queued in all queues
+};
+
+// Memory use of a queue solver run. Each queue records its high-water mark
+// when it grows, which only costs a comparison under the queue lock, and
+// whichever thread finds a sample due claims it, so sampling goes on for as
+// long as any thread polls its queue.
+struct Footprint {
+    int queues;             // number of queues
+    int capacity;           // entries per queue, MAXQUEUE
+    size_t interval_bytes;  // size of a queue entry
+    size_t allocated;       // bytes allocated by the solver
+    int *high_water;        // most entries held by each queue
+
+    double start;
+    double period;          // time between frontier samples
+    double next;            // time of the next sample
+    int sampling;           // set while a thread holds the claim on a sample
+    int peak_frontier;
+    int count;
+    struct FootprintSample samples[FOOTPRINT_MAXSAMPLES];
+};
+
+void footprint_init(struct Footprint *, int queues, int capacity, size_t interval_bytes);
+void footprint_destroy(struct Footprint *);
+
+// Count memory allocated by the solver
+void footprint_alloc(struct Footprint *, size_t bytes);
+
+// Record the size of a queue after intervals were added to it
+void footprint_push(struct Footprint *, int queue, int size);
+
+// Whether a period has passed since the last frontier sample, in which case
+// the calling thread holds the claim on it and must call footprint_sample
+bool footprint_claim(struct Footprint *);
+void footprint_sample(struct Footprint *, int frontier);
+
+// Peak resident set size of the process in bytes
+long footprint_peak_rss(void);
+
+// Print the high-water marks, peak frontier and memory, with a warning for
+// queues close to their capacity
+void footprint_report(struct Footprint *, FILE *);
+
+// Append the run as one line of JSON to the file named by SOLVER_JSON, if set
+void footprint_json(struct Footprint *, const char *solver, int threads, double result, double time,
+                    long evaluations);
+
+#endif
@@ -1,5 +1,9 @@
 #include <math.h> 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "function.h"
 
 double euler(double init, double step, double alpha, int numsteps)
 {
@@ -12,6 +16,132 @@ double euler(double init, double step, double alpha, int numsteps)
 }
 
 
+// Points a vector of the default and AVX2 variants holds, and the most the
+// AVX-512 variant steps together
+#define EULER_LANES 4
+#define EULER_MAXLANES 8
+
+// Step up to lanes points in lockstep. Lanes past m take no steps, and so do
+// lanes that reached their own number of steps, which keeps every point's
+// result the same as that of euler.
+static inline __attribute__((always_inline))
+void euler_lanes(const double *init, const double *step, const double *alpha, const int *numsteps,
+                 double *y, int m, const int lanes)
+{
+  double yk[EULER_MAXLANES], stepk[EULER_MAXLANES], alphak[EULER_MAXLANES];
+  int numstepsk[EULER_MAXLANES];
+  int maxsteps = 0;
+
+  for (int k = 0; k < lanes; k++) {
+    bool used = (k < m);
+
+    yk[k] = used ? init[k] : 0.0;
+    stepk[k] = used ? step[k] : 0.0;
+    alphak[k] = used ? alpha[k] : 0.0;
+    numstepsk[k] = used ? numsteps[k] : 0;
+    if (numstepsk[k] > maxsteps)
+      maxsteps = numstepsk[k];
+  }
+
+  for (int i = 0; i < maxsteps; i++) {
+#pragma omp simd
+    for (int k = 0; k < lanes; k++) {
+      double next = yk[k] + stepk[k] * (alphak[k] - yk[k]);
+      yk[k] = (i < numstepsk[k]) ? next : yk[k];
+    }
+  }
+
+  for (int k = 0; k < m; k++) {
+    y[k] = yk[k];
+  }
+}
+
+static void euler_batch_default(const double *init, const double *step, const double *alpha,
+                                const int *numsteps, double *y, int n)
+{
+  for (int base = 0; base < n; base += EULER_LANES) {
+    int m = (n - base < EULER_LANES) ? n - base : EULER_LANES;
+    euler_lanes(&init[base], &step[base], &alpha[base], &numsteps[base], &y[base], m, EULER_LANES);
+  }
+}
+
+#if KERNEL_VARIANTS
+__attribute__((target("avx2")))
+static void euler_batch_avx2(const double *init, const double *step, const double *alpha,
+                             const int *numsteps, double *y, int n)
+{
+  for (int base = 0; base < n; base += EULER_LANES) {
+    int m = (n - base < EULER_LANES) ? n - base : EULER_LANES;
+    euler_lanes(&init[base], &step[base], &alpha[base], &numsteps[base], &y[base], m, EULER_LANES);
+  }
+}
+
+// Masked lanes are cheap with AVX-512, so 8 points are stepped together when
+// there are more than 4 left. For the 2 points of an interval the 4 lane
+// vector is quicker.
+__attribute__((target("avx512f")))
+static void euler_batch_avx512(const double *init, const double *step, const double *alpha,
+                               const int *numsteps, double *y, int n)
+{
+  for (int base = 0; base < n; ) {
+    int m = n - base;
+
+    if (m > EULER_LANES) {
+      m = (m < EULER_MAXLANES) ? m : EULER_MAXLANES;
+      euler_lanes(&init[base], &step[base], &alpha[base], &numsteps[base], &y[base], m, EULER_MAXLANES);
+    } else {
+      euler_lanes(&init[base], &step[base], &alpha[base], &numsteps[base], &y[base], m, EULER_LANES);
+    }
+
+    base += m;
+  }
+}
+
+typedef void (*EulerBatch)(const double *, const double *, const double *, const int *, double *, int);
+
+// Run by the dynamic loader to bind euler_batch to the variant for the CPU
+static EulerBatch resolve_euler_batch(void)
+{
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512f"))
+    return euler_batch_avx512;
+  if (__builtin_cpu_supports("avx2"))
+    return euler_batch_avx2;
+  return euler_batch_default;
+}
+
+void euler_batch(const double *, const double *, const double *, const int *, double *, int)
+  __attribute__((ifunc("resolve_euler_batch")));
+
+const char *kernel_variant(void)
+{
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512f"))
+    return "avx512f";
+  if (__builtin_cpu_supports("avx2"))
+    return "avx2";
+  return "default";
+}
+#else
+void euler_batch(const double *init, const double *step, const double *alpha, const int *numsteps,
+                 double *y, int n)
+{
+  euler_batch_default(init, step, alpha, numsteps, y, n);
+}
+
+const char *kernel_variant(void)
+{
+#if defined(__INTEL_COMPILER)
+  return "icc -ax dispatch";
+#else
+  return "single";
+#endif
+}
+#endif
+
+
 double func1(double x) 
 {
   double alpha = 100000.0 *sin(x*100000.0); 
@@ -19,3 +149,190 @@ double func1(double x)
   return euler(0.0, 0.0001, alpha, numsteps); 
 } 
 
+
+// The Euler loop dominates, with a small fixed cost for the sine and call
+double func1_cost(double x)
+{
+  double numsteps = 200.0 * x;
+  return 20.0 + (numsteps > 0.0 ? numsteps : 0.0);
+}
+
+double func1_cost_hook(double x, void *data)
+{
+  (void) data;
+  return func1_cost(x);
+}
+
+// Lanes are evaluated in lockstep, a vector of SWEEP_VECTOR lanes at a time,
+// so that each Euler step vectorises across the variants. Lanes outside the
+// mask skip the Euler loop.
+KERNEL_CLONES
+void func1_sweep(double x, const struct Func1Sweep *sweep, unsigned mask, double *fx)
+{
+  double alpha[SWEEP_MAXLANES], step[SWEEP_MAXLANES], y[SWEEP_MAXLANES];
+  int numsteps[SWEEP_MAXLANES];
+
+  for (int k = 0; k < SWEEP_MAXLANES; k++) {
+    bool used = (k < sweep->lanes && (mask & (1u << k)));
+
+    alpha[k] = used ? sweep->amplitude[k] * sin(x * sweep->frequency[k]) : 0.0;
+    step[k] = used ? sweep->step[k] : 0.0;
+    numsteps[k] = used ? (int) (sweep->density[k] * x) : 0;
+    y[k] = 0.0;
+  }
+
+  // Only the vectors holding variants are stepped, each as long as its
+  // longest lane
+  for (int base = 0; base < sweep->lanes; base += SWEEP_VECTOR) {
+    int maxsteps = 0;
+    for (int k = base; k < base + SWEEP_VECTOR; k++) {
+      if (numsteps[k] > maxsteps)
+        maxsteps = numsteps[k];
+    }
+
+    for (int i = 0; i < maxsteps; i++) {
+#pragma omp simd
+      for (int k = base; k < base + SWEEP_VECTOR; k++) {
+        double next = y[k] + step[k] * (alpha[k] - y[k]);
+        y[k] = (i < numsteps[k]) ? next : y[k];
+      }
+    }
+  }
+
+  for (int k = 0; k < sweep->lanes; k++) {
+    fx[k] = y[k];
+  }
+}
+
+// The sines and step counts of func1 for a chunk of points, then their Euler
+// loops together
+void func1_batch(const double *x, double *fx, int n, void *data)
+{
+  (void) data;
+
+  double init[EULER_MAXLANES], step[EULER_MAXLANES], alpha[EULER_MAXLANES];
+  int numsteps[EULER_MAXLANES];
+
+  for (int base = 0; base < n; base += EULER_MAXLANES) {
+    int m = (n - base < EULER_MAXLANES) ? n - base : EULER_MAXLANES;
+
+    for (int k = 0; k < m; k++) {
+      init[k] = 0.0;
+      step[k] = 0.0001;
+      alpha[k] = 100000.0 *sin(x[base + k]*100000.0);
+      numsteps[k] = (int) (200.0 * x[base + k]);
+    }
+
+    euler_batch(init, step, alpha, numsteps, &fx[base], m);
+  }
+}
+
+// First x at which func1 takes k Euler steps. k / 200 is rounded, so step
+// to the exact point at which the truncation of 200 * x reaches k.
+static double func1_jump(long k)
+{
+  double x = k / 200.0;
+
+  while ((long) (200.0 * x) >= k)
+    x = nextafter(x, -INFINITY);
+  while ((long) (200.0 * x) < k)
+    x = nextafter(x, INFINITY);
+
+  return x;
+}
+
+int func1_breakpoints(double left, double right, double *points, int max, void *data)
+{
+  (void) data;
+
+  // There are no steps, and so no jumps, below x = 1 / 200
+  long first = (long) floor(200.0 * left);
+  long last = (long) ceil(200.0 * right);
+  if (first < 1)
+    first = 1;
+
+  int count = 0;
+  for (long k = first; k <= last; k++) {
+    double x = func1_jump(k);
+    if (x <= left || x >= right)
+      continue;
+
+    if (count < max)
+      points[count] = x;
+    count++;
+  }
+
+  return count;
+}
+
+static int compare(const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+int integrand_pieces(const struct Integrand *integrand, double left, double right, struct Piece **pieces)
+{
+  int generated = 0;
+  if (integrand->breakpoints)
+    generated = integrand->breakpoints(left, right, NULL, 0, integrand->data);
+
+  // Both ends of the domain and every breakpoint inside it
+  double *points = (double *) malloc(sizeof(double) * (generated + integrand->nbreaks + 2));
+  if (!points) {
+    printf("Failed to allocate breakpoints - exiting\n");
+    exit(1);
+  }
+
+  int count = 0;
+  points[count++] = left;
+  if (integrand->breakpoints)
+    count += integrand->breakpoints(left, right, &points[count], generated, integrand->data);
+  for (int i = 0; i < integrand->nbreaks; i++) {
+    if (integrand->breaks[i] > left && integrand->breaks[i] < right)
+      points[count++] = integrand->breaks[i];
+  }
+  points[count++] = right;
+
+  // Merge the list with the generated points and drop duplicates
+  qsort(points, count, sizeof(double), compare);
+
+  int unique = 1;
+  for (int i = 1; i < count; i++) {
+    if (points[i] > points[unique - 1])
+      points[unique++] = points[i];
+  }
+
+  int n = unique - 1;
+  *pieces = (struct Piece *) malloc(sizeof(struct Piece) * n);
+  double *x = (double *) malloc(sizeof(double) * 3 * n);
+  double *fx = (double *) malloc(sizeof(double) * 3 * n);
+  if (!*pieces || !x || !fx) {
+    printf("Failed to allocate pieces - exiting\n");
+    exit(1);
+  }
+
+  for (int i = 0; i < n; i++) {
+    double a = points[i], b = points[i + 1];
+
+    x[3 * i]     = (i == 0) ? a : nextafter(a, b);
+    x[3 * i + 1] = (a + b) / 2.0;
+    x[3 * i + 2] = (i == n - 1) ? b : nextafter(b, a);
+  }
+
+  integrand->eval(x, fx, 3 * n, integrand->data);
+
+  for (int i = 0; i < n; i++) {
+    (*pieces)[i].left    = points[i];
+    (*pieces)[i].right   = points[i + 1];
+    (*pieces)[i].f_left  = fx[3 * i];
+    (*pieces)[i].f_mid   = fx[3 * i + 1];
+    (*pieces)[i].f_right = fx[3 * i + 2];
+  }
+
+  free(points);
+  free(x);
+  free(fx);
+
+  return n;
+}
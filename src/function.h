@@ -1,4 +1,104 @@
-double euler(double, double, double, int); 
+#ifndef FUNCTION_H
+#define FUNCTION_H
 
-double func1(double);  
+double euler(double, double, double, int);
 
+// Hot kernels are built for several instruction sets and the best one for the
+// CPU is picked when the program is loaded, so that one binary runs at full
+// speed on every node. GCC and Clang build the variants themselves on x86-64,
+// ICC does the same for the whole program with -ax.
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER) && defined(__x86_64__)
+#define KERNEL_VARIANTS 1
+#define KERNEL_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define KERNEL_VARIANTS 0
+#define KERNEL_CLONES
+#endif
+
+// Instruction set of the kernel variants picked for this CPU
+const char *kernel_variant(void);
+
+// Euler steps of up to n points at once, as euler(init[i], step[i], alpha[i],
+// numsteps[i]) for each i, storing the results in y, which may alias init.
+// The points are stepped in lockstep a vector at a time so that independent
+// points fill the vector lanes instead of waiting on each other's steps.
+void euler_batch(const double *init, const double *step, const double *alpha, const int *numsteps,
+                 double *y, int n);
+
+double func1(double);
+
+// Integrand evaluated on a batch of abscissae at once. eval stores the function
+// value at x[i] in fx[i] for each of the n points. data is passed through
+// unchanged so that callers can attach their own state.
+//
+// Points where the integrand jumps can optionally be declared, as a sorted
+// list of nbreaks points in breaks, through a generator, or both. The
+// generator stores the breakpoints strictly inside (left, right) in
+// increasing order in points, at most max of them, and returns how many
+// there are in total.
+//
+// noise is the relative error of the function values, DBL_EPSILON if 0. The
+// solvers stop splitting an interval once its error estimate is within it.
+//
+// cost optionally gives the relative cost of an evaluation at x, which the
+// queue solvers use to hand out the most expensive intervals first.
+struct Integrand {
+    void (*eval)(const double *x, double *fx, int n, void *data);
+    void *data;
+    const double *breaks;
+    int nbreaks;
+    int (*breakpoints)(double left, double right, double *points, int max, void *data);
+    double noise;
+    double (*cost)(double x, void *data);
+};
+
+// Piece of the domain between two breakpoints with its ends and midpoint
+// evaluated
+struct Piece {
+    double left, right;
+    double f_left, f_mid, f_right;
+};
+
+// Split [left, right] at the integrand's breakpoints and evaluate the ends and
+// midpoint of every piece in one batch, 3 evaluations per piece. Ends at a
+// breakpoint are evaluated one ulp inside the piece so that each piece only
+// sees its own side of a jump. Returns the number of pieces, *pieces must be
+// freed.
+int integrand_pieces(const struct Integrand *, double left, double right, struct Piece **pieces);
+
+void func1_batch(const double *, double *, int, void *);
+
+// Relative error of func1's values, mostly from rounding 100000 * x before
+// taking the sine, measured against a long double evaluation on [9, 10]
+#define FUNC1_NOISE 1.0e-11
+
+// Breakpoint generator of func1, whose number of Euler steps and so its value
+// jumps at every x = k / 200
+int func1_breakpoints(double, double, double *, int, void *);
+
+// Relative cost of evaluating func1 at x
+double func1_cost(double);
+
+// func1_cost as the cost hook of an integrand
+double func1_cost_hook(double, void *);
+
+// Maximum number of parameter variants of func1 evaluated together
+#define SWEEP_MAXLANES 16
+
+// Lanes stepped together, SWEEP_MAXLANES must be a multiple of it
+#define SWEEP_VECTOR 4
+
+// Parameter variants of func1, one lane per variant. The coursework values
+// are amplitude = frequency = 100000, density = 200 and step = 0.0001.
+struct Func1Sweep {
+    int lanes;
+    double amplitude[SWEEP_MAXLANES]; // amplitude of the sine
+    double frequency[SWEEP_MAXLANES]; // frequency of the sine
+    double density[SWEEP_MAXLANES];   // Euler steps per unit of x
+    double step[SWEEP_MAXLANES];      // Euler step size
+};
+
+// Evaluate every variant whose bit is set in mask at x, one lane per variant
+void func1_sweep(double x, const struct Func1Sweep *, unsigned mask, double *fx);
+
+#endif
@@ -0,0 +1,308 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "idle.h"
+
+// Parked threads re-check for work at least this often in case a wake-up was
+// missed between deciding to park and going to sleep.
+#define IDLE_TIMEOUT_NS 50000000L
+
+bool idle_mode_parse(enum IdleMode *mode)
+{
+    const char *setting = getenv("SOLVER_IDLE");
+
+    *mode = IDLE_SPIN;
+
+    if (!setting || strcmp(setting, "spin") == 0)
+        return true;
+    if (strcmp(setting, "park") == 0)
+        *mode = IDLE_PARK;
+    else if (strcmp(setting, "yield") == 0)
+        *mode = IDLE_YIELD;
+    else if (strcmp(setting, "auto") == 0)
+        *mode = IDLE_AUTO;
+    else
+        return false;
+
+    return true;
+}
+
+enum IdleMode idle_mode_from_env(void)
+{
+    enum IdleMode mode;
+
+    if (!idle_mode_parse(&mode)) {
+        printf("Unknown SOLVER_IDLE mode '%s' - exiting\n", getenv("SOLVER_IDLE"));
+        exit(1);
+    }
+
+    return mode;
+}
+
+// CPU quota in cores from cgroup v2 cpu.max or cgroup v1 cfs quota, or a
+// negative value if there is no quota
+static double cgroup_quota(void)
+{
+    double quota = -1.0, period = -1.0;
+    char max[32];
+
+    FILE *file = fopen("/sys/fs/cgroup/cpu.max", "r");
+    if (file) {
+        // "<quota> <period>" or "max <period>"
+        if (fscanf(file, "%31s %lf", max, &period) == 2 && strcmp(max, "max") != 0)
+            quota = atof(max);
+        fclose(file);
+    } else {
+        file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+        if (file) {
+            if (fscanf(file, "%lf", &quota) != 1)
+                quota = -1.0;
+            fclose(file);
+        }
+
+        file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+        if (file) {
+            if (fscanf(file, "%lf", &period) != 1)
+                period = -1.0;
+            fclose(file);
+        }
+    }
+
+    if (quota <= 0.0 || period <= 0.0)
+        return -1.0;
+
+    return quota / period;
+}
+
+int idle_effective_cores(void)
+{
+    int cores = omp_get_num_procs();
+
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        cores = CPU_COUNT(&set);
+
+    // A quota of 1.5 cores still lets two threads make progress
+    double quota = cgroup_quota();
+    if (quota > 0.0 && (int)ceil(quota) < cores)
+        cores = (int)ceil(quota);
+
+    return (cores > 0) ? cores : 1;
+}
+
+int idle_team_size(enum IdleMode mode, int requested)
+{
+    if (mode != IDLE_AUTO)
+        return requested;
+
+    int cores = idle_effective_cores();
+    return (requested <= cores) ? requested : cores;
+}
+
+void idle_init(struct Idle *idle, int team, enum IdleMode mode)
+{
+    assert(idle && team > 0);
+
+    idle->mode    = mode;
+    idle->team    = team;
+    idle->running = team;
+    idle->wakeups = 0;
+    idle->stop    = 0;
+    pthread_mutex_init(&idle->mutex, NULL);
+    pthread_cond_init(&idle->cond, NULL);
+
+    idle->start       = omp_get_wtime();
+    idle->last        = idle->start;
+    idle->weighted    = 0.0;
+    idle->min_running = team;
+    idle->parks       = 0;
+    idle->nsamples    = 0;
+    idle->samples     = NULL;
+
+    if (mode == IDLE_PARK) {
+        idle->samples = (struct IdleSample *)malloc(sizeof(struct IdleSample) * IDLE_MAXSAMPLES);
+        if (!idle->samples) {
+            printf("Failed to allocate idle samples - exiting\n");
+            exit(1);
+        }
+    }
+}
+
+void idle_destroy(struct Idle *idle)
+{
+    pthread_cond_destroy(&idle->cond);
+    pthread_mutex_destroy(&idle->mutex);
+    free(idle->samples);
+    idle->samples = NULL;
+}
+
+// Change the running thread count, must hold the mutex
+static void set_running(struct Idle *idle, int running)
+{
+    double now = omp_get_wtime();
+
+    idle->weighted += idle->running * (now - idle->last);
+    idle->last = now;
+
+    #pragma omp atomic write
+    idle->running = running;
+
+    if (running < idle->min_running)
+        idle->min_running = running;
+
+    if (idle->nsamples < IDLE_MAXSAMPLES) {
+        idle->samples[idle->nsamples].time    = now - idle->start;
+        idle->samples[idle->nsamples].running = running;
+        idle->nsamples++;
+    }
+}
+
+void idle_wait(struct Idle *idle, int queued, int active)
+{
+    // Let a thread holding a queue lock run if the cores are shared
+    if (idle->mode == IDLE_YIELD || idle->mode == IDLE_AUTO) {
+        sched_yield();
+        return;
+    }
+
+    if (idle->mode != IDLE_PARK)
+        return;
+
+    // Only park if the other idle threads can take every queued interval,
+    // which always leaves one thread polling for new work.
+    int running;
+    #pragma omp atomic read
+    running = idle->running;
+
+    if (running - active - 1 <= queued)
+        return;
+
+    pthread_mutex_lock(&idle->mutex);
+
+    if (idle->stop || idle->running - active - 1 <= queued) {
+        pthread_mutex_unlock(&idle->mutex);
+        return;
+    }
+
+    set_running(idle, idle->running - 1);
+    idle->parks++;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += IDLE_TIMEOUT_NS;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    int status = 0;
+    while (!idle->stop && idle->wakeups == 0 && status != ETIMEDOUT) {
+        status = pthread_cond_timedwait(&idle->cond, &idle->mutex, &deadline);
+    }
+
+    if (idle->wakeups > 0)
+        idle->wakeups--;
+
+    set_running(idle, idle->running + 1);
+
+    pthread_mutex_unlock(&idle->mutex);
+}
+
+void idle_pause(struct Idle *idle)
+{
+    // The wait is too short to park for, but the thread waited for may need
+    // the core
+    if (idle->mode != IDLE_SPIN)
+        sched_yield();
+}
+
+void idle_notify(struct Idle *idle, int queued, int active)
+{
+    if (idle->mode != IDLE_PARK)
+        return;
+
+    int running;
+    #pragma omp atomic read
+    running = idle->running;
+
+    // Enough threads are already polling for the queued intervals
+    if (running == idle->team || queued <= running - active)
+        return;
+
+    pthread_mutex_lock(&idle->mutex);
+    {
+        int wanted = queued - (idle->running - active) - idle->wakeups;
+        int parked = idle->team - idle->running - idle->wakeups;
+
+        if (wanted > parked)
+            wanted = parked;
+
+        if (wanted > 0) {
+            idle->wakeups += wanted;
+
+            if (wanted == 1)
+                pthread_cond_signal(&idle->cond);
+            else
+                pthread_cond_broadcast(&idle->cond);
+        }
+    }
+    pthread_mutex_unlock(&idle->mutex);
+}
+
+void idle_stop(struct Idle *idle)
+{
+    if (idle->mode != IDLE_PARK)
+        return;
+
+    pthread_mutex_lock(&idle->mutex);
+    {
+        if (!idle->stop) {
+            idle->stop = 1;
+            pthread_cond_broadcast(&idle->cond);
+        }
+    }
+    pthread_mutex_unlock(&idle->mutex);
+}
+
+void idle_report(struct Idle *idle, FILE *out)
+{
+    if (idle->mode != IDLE_PARK)
+        return;
+
+    double now = omp_get_wtime();
+    double elapsed = now - idle->start;
+    double weighted = idle->weighted + idle->running * (now - idle->last);
+
+    fprintf(out, "Parks = %ld\n", idle->parks);
+    fprintf(out, "Running threads (mean) = %.2f\n", elapsed > 0.0 ? weighted / elapsed : (double)idle->team);
+    fprintf(out, "Running threads (min) = %d\n", idle->min_running);
+
+    // Running thread count over time as CSV for plotting
+    const char *path = getenv("SOLVER_IDLE_TRACE");
+    if (!path)
+        return;
+
+    FILE *trace = fopen(path, "w");
+    if (!trace) {
+        fprintf(out, "Failed to open %s\n", path);
+        return;
+    }
+
+    fprintf(trace, "time,running\n");
+    fprintf(trace, "%f,%d\n", 0.0, idle->team);
+    for (int i = 0; i < idle->nsamples; ++i) {
+        fprintf(trace, "%f,%d\n", idle->samples[i].time, idle->samples[i].running);
+    }
+    fprintf(trace, "%f,%d\n", elapsed, idle->running);
+
+    fclose(trace);
+}
@@ -0,0 +1,76 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// What a thread does when it finds no interval to process. Selected with the
+// SOLVER_IDLE environment variable.
+enum IdleMode {
+    IDLE_SPIN,  // keep polling the queues (default)
+    IDLE_PARK,  // sleep while there are fewer queued intervals than idle threads
+    IDLE_YIELD, // give up the core between polls
+    IDLE_AUTO   // yield and limit the team to the cores actually available
+};
+
+// Maximum number of recorded changes of the running thread count
+#define IDLE_MAXSAMPLES 65536
+
+struct IdleSample {
+    double time;  // seconds since idle_init
+    int running;  // threads not parked
+};
+
+struct Idle {
+    enum IdleMode mode;
+    int team;             // number of threads in the team
+    int running;          // threads not parked
+    int wakeups;          // pending wake-ups for parked threads
+    int stop;             // set once the solver terminates
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    // Statistics of the running thread count over time
+    double start;
+    double last;          // time of the last change
+    double weighted;      // integral of running threads over time
+    int min_running;
+    long parks;           // number of times a thread parked
+    int nsamples;
+    struct IdleSample *samples;
+};
+
+// Mode selected by SOLVER_IDLE. Returns false, leaving the default spin mode,
+// if it names no mode. idle_mode_from_env exits instead and is meant for main.
+bool idle_mode_parse(enum IdleMode *);
+enum IdleMode idle_mode_from_env(void);
+
+// Number of cores the process may run on, taking both its CPU affinity and
+// any cgroup CPU quota into account
+int idle_effective_cores(void);
+
+// Team size for the requested number of threads under the given mode
+int idle_team_size(enum IdleMode, int requested);
+
+void idle_init(struct Idle *, int team, enum IdleMode);
+void idle_destroy(struct Idle *);
+
+// Called by a thread that found no work, with the current number of queued
+// intervals and threads processing one. May put the thread to sleep.
+void idle_wait(struct Idle *, int queued, int active);
+
+// Called by a thread waiting briefly for another thread, such as the owner of
+// a help slot for its helper. Spins, or yields the core in the other modes.
+void idle_pause(struct Idle *);
+
+// Called after intervals were queued to unpark threads for them
+void idle_notify(struct Idle *, int queued, int active);
+
+// Wake all parked threads for termination and stop parking
+void idle_stop(struct Idle *);
+
+// Print running thread statistics and write the samples to SOLVER_IDLE_TRACE
+void idle_report(struct Idle *, FILE *);
+
+#endif
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "memo.h"
+
+// Key of an empty entry, the bits of a NaN that is never an abscissa
+#define MEMO_EMPTY UINT64_MAX
+
+// Largest batch looked up at once, longer batches are split
+#define MEMO_BATCH 64
+
+static uint64_t bits(double x)
+{
+    uint64_t key;
+    memcpy(&key, &x, sizeof(key));
+    return key;
+}
+
+// Mix the bits of the abscissa so that nearby points land in different sets
+static uint64_t hash(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+void memo_init(struct Memo *memo, const struct Integrand *inner, size_t budget)
+{
+    assert(memo && inner);
+
+    memo->inner = inner;
+
+    // Largest power of two number of sets within the budget
+    size_t set_bytes = MEMO_WAYS * sizeof(struct MemoEntry) + 1;
+    memo->sets = 1;
+    while (memo->sets * 2 * set_bytes <= budget) {
+        memo->sets *= 2;
+    }
+
+    memo->entries = (struct MemoEntry *)malloc(memo->sets * MEMO_WAYS * sizeof(struct MemoEntry));
+    memo->victim = (unsigned char *)calloc(memo->sets, 1);
+    if (!memo->entries || !memo->victim) {
+        printf("Failed to allocate memo - exiting\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < memo->sets * MEMO_WAYS; ++i) {
+        memo->entries[i].key = MEMO_EMPTY;
+    }
+
+    for (int i = 0; i < MEMO_STRIPES; ++i) {
+        omp_init_lock(&memo->locks[i]);
+    }
+
+    memo_reset_stats(memo);
+}
+
+void memo_destroy(struct Memo *memo)
+{
+    for (int i = 0; i < MEMO_STRIPES; ++i) {
+        omp_destroy_lock(&memo->locks[i]);
+    }
+
+    free(memo->entries);
+    free(memo->victim);
+    memo->entries = NULL;
+    memo->victim = NULL;
+}
+
+// Look up a key, returns whether it was found
+static int lookup(struct Memo *memo, uint64_t key, double *value)
+{
+    size_t set = hash(key) & (memo->sets - 1);
+    struct MemoEntry *entry = &memo->entries[set * MEMO_WAYS];
+    omp_lock_t *lock = &memo->locks[set % MEMO_STRIPES];
+    int found = 0;
+
+    omp_set_lock(lock);
+    for (int way = 0; way < MEMO_WAYS; ++way) {
+        if (entry[way].key == key) {
+            *value = entry[way].value;
+            found = 1;
+            break;
+        }
+    }
+    omp_unset_lock(lock);
+
+    return found;
+}
+
+// Insert a key, returns whether another entry was evicted
+static int insert(struct Memo *memo, uint64_t key, double value)
+{
+    size_t set = hash(key) & (memo->sets - 1);
+    struct MemoEntry *entry = &memo->entries[set * MEMO_WAYS];
+    omp_lock_t *lock = &memo->locks[set % MEMO_STRIPES];
+    int evicted = 0;
+
+    omp_set_lock(lock);
+    {
+        int way;
+        for (way = 0; way < MEMO_WAYS; ++way) {
+            // Another thread may have inserted the same point meanwhile
+            if (entry[way].key == key || entry[way].key == MEMO_EMPTY)
+                break;
+        }
+
+        if (way == MEMO_WAYS) {
+            way = memo->victim[set];
+            memo->victim[set] = (way + 1) % MEMO_WAYS;
+            evicted = 1;
+        }
+
+        entry[way].key = key;
+        entry[way].value = value;
+    }
+    omp_unset_lock(lock);
+
+    return evicted;
+}
+
+void memo_eval(const double *x, double *fx, int n, void *data)
+{
+    struct Memo *memo = (struct Memo *)data;
+
+    // Points not found are evaluated together as one batch of the integrand
+    double missed_x[MEMO_BATCH], missed_fx[MEMO_BATCH];
+    int missed_index[MEMO_BATCH];
+
+    for (int first = 0; first < n; first += MEMO_BATCH) {
+        int count = (n - first < MEMO_BATCH) ? n - first : MEMO_BATCH;
+        int missed = 0, evicted = 0;
+
+        for (int i = first; i < first + count; ++i) {
+            if (!lookup(memo, bits(x[i]), &fx[i])) {
+                missed_x[missed] = x[i];
+                missed_index[missed] = i;
+                missed++;
+            }
+        }
+
+        if (missed > 0)
+            memo->inner->eval(missed_x, missed_fx, missed, memo->inner->data);
+
+        for (int i = 0; i < missed; ++i) {
+            fx[missed_index[i]] = missed_fx[i];
+            evicted += insert(memo, bits(missed_x[i]), missed_fx[i]);
+        }
+
+        #pragma omp atomic
+        memo->hits += count - missed;
+        #pragma omp atomic
+        memo->misses += missed;
+        #pragma omp atomic
+        memo->evictions += evicted;
+    }
+}
+
+int memo_breakpoints(double left, double right, double *points, int max, void *data)
+{
+    struct Memo *memo = (struct Memo *)data;
+
+    return memo->inner->breakpoints(left, right, points, max, memo->inner->data);
+}
+
+double memo_cost(double x, void *data)
+{
+    struct Memo *memo = (struct Memo *)data;
+
+    return memo->inner->cost(x, memo->inner->data);
+}
+
+void memo_reset_stats(struct Memo *memo)
+{
+    memo->hits = 0;
+    memo->misses = 0;
+    memo->evictions = 0;
+}
+
+void memo_report(struct Memo *memo, FILE *out)
+{
+    long lookups = memo->hits + memo->misses;
+
+    fprintf(out, "Memo size(MB) = %f\n", memo->sets * MEMO_WAYS * sizeof(struct MemoEntry) / 1048576.0);
+    fprintf(out, "Memo hits = %ld\n", memo->hits);
+    fprintf(out, "Memo misses = %ld\n", memo->misses);
+    fprintf(out, "Memo evictions = %ld\n", memo->evictions);
+    fprintf(out, "Memo hit rate = %f\n", lookups > 0 ? (double)memo->hits / lookups : 0.0);
+}
@@ -0,0 +1,53 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <omp.h>
+
+#include "function.h"
+
+// Entries per set of the memo table, a full set evicts round robin
+#define MEMO_WAYS 4
+
+// Number of locks protecting the sets
+#define MEMO_STRIPES 1024
+
+struct MemoEntry {
+    uint64_t key;  // bits of the abscissa
+    double value;  // function value
+};
+
+// Concurrent memo of function values keyed on the exact bits of the abscissa.
+// Wrapping an integrand in a memo lets integrals over overlapping domains
+// reuse each other's evaluations. The table never grows beyond its budget.
+struct Memo {
+    const struct Integrand *inner;     // integrand being memoised
+    struct MemoEntry *entries;         // sets * MEMO_WAYS entries
+    unsigned char *victim;             // next entry to evict in each set
+    size_t sets;                       // number of sets, a power of two
+    omp_lock_t locks[MEMO_STRIPES];
+
+    long hits;
+    long misses;
+    long evictions;
+};
+
+// Create a memo using at most budget bytes for its table
+void memo_init(struct Memo *, const struct Integrand *inner, size_t budget);
+void memo_destroy(struct Memo *);
+
+// Integrand evaluation through the memo, data is the struct Memo
+void memo_eval(const double *x, double *fx, int n, void *data);
+
+// Breakpoints of the memoised integrand's generator, data is the struct Memo
+int memo_breakpoints(double left, double right, double *points, int max, void *data);
+
+// Cost hook of the memoised integrand, data is the struct Memo
+double memo_cost(double x, void *data);
+
+void memo_reset_stats(struct Memo *);
+void memo_report(struct Memo *, FILE *);
+
+#endif
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+
+#include "tasks.h"
+
+// Depth of the binary task tree, giving 2^(DEPTH+1) - 2 tasks
+#define DEPTH 20
+
+// Lock acquisitions per thread
+#define LOCKS 1000000
+
+// Spawn two tasks per call and wait for both, the same pattern as solver1
+long tree(int depth)
+{
+    if (depth == 0)
+        return 0;
+
+    long left, right;
+
+#pragma omp task default(none) shared(left) firstprivate(depth)
+    {
+        left = tree(depth - 1);
+    }
+
+#pragma omp task default(none) shared(right) firstprivate(depth)
+    {
+        right = tree(depth - 1);
+    }
+
+#pragma omp taskwait
+    return left + right + 2;
+}
+
+// Measure task creation and completion throughput in tasks per second
+double task_throughput(void)
+{
+    long tasks = 0;
+
+    double start = omp_get_wtime();
+
+#pragma omp parallel default(none) shared(tasks)
+    {
+#pragma omp single
+        {
+            tasks = tree(DEPTH);
+        }
+    }
+
+    return tasks / (omp_get_wtime() - start);
+}
+
+// The same tree on the spawn/sync runtime of tasks.c, as ported solver1:
+// one half is spawned and the other called directly
+struct Node {
+    int depth;
+    long tasks;
+};
+
+void spawn_tree(void *arg)
+{
+    struct Node *node = (struct Node *)arg;
+
+    if (node->depth == 0) {
+        node->tasks = 0;
+        return;
+    }
+
+    struct Node left = { node->depth - 1, 0 };
+    struct Node right = { node->depth - 1, 0 };
+    struct Task task;
+
+    task_spawn(&task, spawn_tree, &left);
+    spawn_tree(&right);
+    task_sync(&task);
+
+    node->tasks = left.tasks + right.tasks + 2;
+}
+
+// Measure the throughput of the spawn/sync runtime in tree nodes per second,
+// which matches tasks per second of task_throughput
+double spawn_throughput(void)
+{
+    struct Node root = { DEPTH, 0 };
+
+    double start = omp_get_wtime();
+    tasks_run(spawn_tree, NULL, &root, NULL);
+
+    return root.tasks / (omp_get_wtime() - start);
+}
+
+// Measure the cost in nanoseconds of a set/unset lock pair, either with each
+// thread using its own lock or with all threads sharing a single lock
+double lock_cost(int contended)
+{
+    int thread_count = omp_get_max_threads();
+    omp_lock_t *locks = (omp_lock_t *)malloc(sizeof(omp_lock_t) * thread_count);
+    if (!locks) {
+        printf("Failed to allocate locks - exiting\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < thread_count; ++i) {
+        omp_init_lock(&locks[i]);
+    }
+
+    double elapsed = 0.0;
+
+#pragma omp parallel default(none) shared(locks, contended) reduction(max: elapsed)
+    {
+        omp_lock_t *lock = contended ? &locks[0] : &locks[omp_get_thread_num()];
+
+#pragma omp barrier
+        double start = omp_get_wtime();
+
+        for (int i = 0; i < LOCKS; ++i) {
+            omp_set_lock(lock);
+            omp_unset_lock(lock);
+        }
+
+        elapsed = omp_get_wtime() - start;
+    }
+
+    for (int i = 0; i < thread_count; ++i) {
+        omp_destroy_lock(&locks[i]);
+    }
+
+    free(locks);
+
+    return elapsed / LOCKS * 1.0e9;
+}
+
+int main(void)
+{
+    printf("Threads: %d\n", omp_get_max_threads());
+
+    // Warm up the runtime so that thread creation is not measured
+#pragma omp parallel
+    {
+    }
+
+    printf("Task throughput(tasks/s) = %e\n", task_throughput());
+    printf("Spawn throughput(tasks/s) = %e\n", spawn_throughput());
+    printf("Lock cost uncontended(ns) = %f\n", lock_cost(0));
+    printf("Lock cost contended(ns) = %f\n", lock_cost(1));
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+
+#include "function.h"
+#include "solver.h"
+#include "quadpack.h"
+
+// Subintervals allowed to QUADPACK. QAGS keeps its subintervals sorted by
+// error, which costs time linear in their number at each bisection.
+#define QAG_LIMIT  1000000
+#define QAGS_LIMIT 100000
+
+static void exp_batch(const double *x, double *fx, int n, void *data)
+{
+    (void) data;
+    for (int i = 0; i < n; ++i) {
+        fx[i] = exp(x[i]);
+    }
+}
+
+static void peak_batch(const double *x, double *fx, int n, void *data)
+{
+    (void) data;
+    for (int i = 0; i < n; ++i) {
+        fx[i] = 1.0 / (1.0e-4 + (x[i] - 0.3) * (x[i] - 0.3));
+    }
+}
+
+static void sqrt_batch(const double *x, double *fx, int n, void *data)
+{
+    (void) data;
+    for (int i = 0; i < n; ++i) {
+        fx[i] = sqrt(x[i]);
+    }
+}
+
+static void oscillatory_batch(const double *x, double *fx, int n, void *data)
+{
+    (void) data;
+    for (int i = 0; i < n; ++i) {
+        fx[i] = cos(100.0 * x[i]);
+    }
+}
+
+static void step_batch(const double *x, double *fx, int n, void *data)
+{
+    (void) data;
+    for (int i = 0; i < n; ++i) {
+        fx[i] = (x[i] < 0.3) ? 0.0 : 1.0;
+    }
+}
+
+// Integral of func1 over [0, 10]. The number of Euler steps is constant on
+// each [k/200, (k+1)/200), where the Euler iterate is the closed form
+// alpha * (1 - (1 - step)^k), so each piece integrates exactly. This agrees
+// with the rounded Euler loop to within 7.6e-11.
+static double func1_exact(void)
+{
+    double sum = 0.0;
+
+    for (int k = 0; k < 2000; ++k) {
+        double a = k / 200.0, b = (k + 1) / 200.0;
+        double scale = -expm1(k * log1p(-0.0001));
+
+        // amplitude / frequency = 1
+        sum += scale * (cos(100000.0 * a) - cos(100000.0 * b));
+    }
+
+    return sum;
+}
+
+// Integrands with known integrals. The synthetic ones are smooth, sharply
+// peaked, have an endpoint singularity in the derivative, oscillate, or jump.
+// None of them declares breakpoints, noise or a cost model.
+struct Problem {
+    const char *name;
+    struct Integrand integrand;
+    double left, right;
+    double tol_max, tol_min;  // tolerances swept by default
+};
+
+static const struct Problem problems[] = {
+    { "exp",         { exp_batch, NULL, NULL, 0, NULL, 0.0, NULL },         0.0, 1.0,  1e-3, 1e-10 },
+    { "peak",        { peak_batch, NULL, NULL, 0, NULL, 0.0, NULL },        0.0, 1.0,  1e-3, 1e-10 },
+    { "sqrt",        { sqrt_batch, NULL, NULL, 0, NULL, 0.0, NULL },        0.0, 1.0,  1e-3, 1e-10 },
+    { "oscillatory", { oscillatory_batch, NULL, NULL, 0, NULL, 0.0, NULL }, 0.0, 1.0,  1e-3, 1e-10 },
+    { "step",        { step_batch, NULL, NULL, 0, NULL, 0.0, NULL },        0.0, 1.0,  1e-3, 1e-10 },
+    { "func1",       { func1_batch, NULL, NULL, 0, NULL, 0.0, NULL },       0.0, 10.0, 1e-4, 1e-7 },
+};
+
+#define PROBLEMS (int)(sizeof(problems) / sizeof(problems[0]))
+
+static double exact(int p)
+{
+    switch (p) {
+    case 0: return exp(1.0) - 1.0;
+    case 1: return 100.0 * (atan(70.0) + atan(30.0));
+    case 2: return 2.0 / 3.0;
+    case 3: return sin(100.0) / 100.0;
+    case 4: return 0.7;
+    default: return func1_exact();
+    }
+}
+
+static void row(const char *problem, const char *method, int threads, double tol, double result, double expected,
+                long evaluations, double time, int status)
+{
+    printf("%s,%s,%d,%e,%.17e,%e,%ld,%f,%d\n", problem, method, threads, tol, result, fabs(result - expected),
+           evaluations, time, status);
+    fflush(stdout);
+}
+
+// Integrate a problem to one tolerance with the linked solver and QUADPACK
+static void run(int p, const char *solver, double tol)
+{
+    const struct Problem *problem = &problems[p];
+    double expected = exact(p);
+
+    // The solvers accept an interval once |q2 - q1| is below tol,
+    // QUADPACK once the summed error estimate is below it
+    struct SolverStats stats = { 0 };
+    double start = omp_get_wtime();
+    double quad = integrate(&problem->integrand, problem->left, problem->right, tol, &stats);
+    row(problem->name, solver, stats.threads, tol, quad, expected, stats.evaluations,
+        omp_get_wtime() - start, 0);
+
+    struct Quadpack out;
+    start = omp_get_wtime();
+    qag(&problem->integrand, problem->left, problem->right, tol, 0.0, QAG_LIMIT, &out);
+    row(problem->name, "qag", 1, tol, out.result, expected, out.evaluations, omp_get_wtime() - start, out.ier);
+
+    start = omp_get_wtime();
+    qags(&problem->integrand, problem->left, problem->right, tol, 0.0, QAGS_LIMIT, &out);
+    row(problem->name, "qags", 1, tol, out.result, expected, out.evaluations, omp_get_wtime() - start, out.ier);
+}
+
+int main(int argc, char **argv)
+{
+    // pareto_<solver> [problem [tol...]]
+    const char *solver = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+    if (strncmp(solver, "pareto_", 7) == 0)
+        solver += 7;
+
+    int only = -1;
+    if (argc > 1) {
+        for (int p = 0; p < PROBLEMS; ++p) {
+            if (strcmp(argv[1], problems[p].name) == 0)
+                only = p;
+        }
+        if (only < 0) {
+            printf("Unknown problem %s - exiting\n", argv[1]);
+            exit(1);
+        }
+    }
+
+    printf("problem,method,threads,tol,result,error,evaluations,time,status\n");
+
+    for (int p = 0; p < PROBLEMS; ++p) {
+        if (only >= 0 && p != only)
+            continue;
+
+        if (argc > 2) {
+            for (int i = 2; i < argc; ++i) {
+                run(p, solver, atof(argv[i]));
+            }
+        } else {
+            // Tolerances a decade apart
+            for (double tol = problems[p].tol_max; tol >= problems[p].tol_min * 0.99; tol /= 10.0) {
+                run(p, solver, tol);
+            }
+        }
+    }
+}
@@ -0,0 +1,283 @@
+// Python bindings for the separate queue solver.
+//
+//     import solver
+//     solver.integrate("func1", 0.0, 10.0, 1e-6)
+//     solver.integrate("x * exp(-x)", 0.0, 10.0)
+//     solver.integrate(lambda x: numpy.sin(x), 0.0, 1.0)
+//
+// The GIL is released for the whole integration. Built-in integrands such as
+// func1 and expressions never touch the interpreter. Python integrands are called with a batch
+// of abscissae that aliases the solver's own buffer (a NumPy array when NumPy
+// is available, a memoryview otherwise) and must return one value per point.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <string.h>
+#include <omp.h>
+
+#include "function.h"
+#include "solver.h"
+#include "expr.h"
+#include "cost.h"
+#include "idle.h"
+
+struct Callback {
+    PyObject *func;       // Python callable
+    PyObject *frombuffer; // numpy.frombuffer or NULL
+    int failed;           // set once the callable has raised
+    PyObject *type;       // saved exception of the first failure
+    PyObject *value;
+    PyObject *traceback;
+};
+
+struct Builtin {
+    const char *name;
+    void (*eval)(const double *, double *, int, void *);
+};
+
+static const struct Builtin builtins[] = {
+    { "func1", func1_batch },
+};
+
+// Only one integration may use the solver at a time as it owns all threads
+static PyThread_type_lock solver_lock;
+
+// Copy the callable's result for a batch of n points into fx
+static int store_result(PyObject *result, double *fx, int n)
+{
+    Py_buffer view;
+
+    // Fast path: contiguous buffer of doubles such as a float64 array
+    if (PyObject_GetBuffer(result, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) == 0) {
+        int ok = (view.format && strcmp(view.format, "d") == 0 &&
+                  view.len == (Py_ssize_t)(n * sizeof(double)));
+        if (ok)
+            memcpy(fx, view.buf, n * sizeof(double));
+        PyBuffer_Release(&view);
+        if (ok)
+            return 0;
+    }
+    PyErr_Clear();
+
+    PyObject *seq = PySequence_Fast(result, "integrand must return a sequence of floats");
+    if (!seq)
+        return -1;
+
+    if (PySequence_Fast_GET_SIZE(seq) != n) {
+        PyErr_Format(PyExc_ValueError, "integrand returned %zd values for %d points",
+                     PySequence_Fast_GET_SIZE(seq), n);
+        Py_DECREF(seq);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        fx[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i));
+        if (fx[i] == -1.0 && PyErr_Occurred()) {
+            Py_DECREF(seq);
+            return -1;
+        }
+    }
+
+    Py_DECREF(seq);
+    return 0;
+}
+
+// Batch evaluation called from the solver threads without the GIL held
+static void callback_eval(const double *x, double *fx, int n, void *data)
+{
+    struct Callback *cb = (struct Callback *)data;
+    int status = -1;
+
+    PyGILState_STATE state = PyGILState_Ensure();
+
+    if (!cb->failed) {
+        // Expose the abscissae without copying. The buffer only lives for the
+        // duration of the call so the callable must not keep a reference.
+        PyObject *points = PyMemoryView_FromMemory((char *)x, n * sizeof(double), PyBUF_READ);
+        if (points) {
+            PyObject *array = cb->frombuffer
+                ? PyObject_CallFunction(cb->frombuffer, "Os", points, "float64")
+                : PyObject_CallMethod(points, "cast", "s", "d");
+            Py_DECREF(points);
+            points = array;
+        }
+
+        if (points) {
+            PyObject *result = PyObject_CallOneArg(cb->func, points);
+            Py_DECREF(points);
+
+            if (result) {
+                status = store_result(result, fx, n);
+                Py_DECREF(result);
+            }
+        }
+
+        if (status != 0) {
+            cb->failed = 1;
+            PyErr_Fetch(&cb->type, &cb->value, &cb->traceback);
+        }
+    }
+
+    PyGILState_Release(state);
+
+    // Zero values satisfy the tolerance immediately so the solver drains its
+    // queues quickly once the integrand has failed.
+    if (status != 0) {
+        for (int i = 0; i < n; i++)
+            fx[i] = 0.0;
+    }
+}
+
+static PyObject *solver_integrate(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = { "f", "left", "right", "tol", "threads", "native", NULL };
+
+    PyObject *f;
+    double left, right, tol = 1e-06;
+    int threads = 0;
+    int native = 1;
+
+    (void)self;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Odd|dip", keywords,
+                                     &f, &left, &right, &tol, &threads, &native))
+        return NULL;
+
+    struct Integrand integrand = { NULL, NULL, NULL, 0, NULL, 0.0, NULL };
+    struct Expr expr;
+    int expression = 0;
+    struct Callback cb = { NULL, NULL, 0, NULL, NULL, NULL };
+
+    if (PyUnicode_Check(f)) {
+        const char *name = PyUnicode_AsUTF8(f);
+        if (!name)
+            return NULL;
+
+        for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+            if (strcmp(name, builtins[i].name) == 0)
+                integrand.eval = builtins[i].eval;
+        }
+
+        // Anything else is an expression in x, compiled for this call
+        if (!integrand.eval) {
+            char error[256];
+            int valid;
+
+            Py_BEGIN_ALLOW_THREADS
+            valid = expr_compile(&expr, name, native, error, sizeof(error));
+            Py_END_ALLOW_THREADS
+
+            if (!valid) {
+                PyErr_Format(PyExc_ValueError, "invalid integrand '%s': %s", name, error);
+                return NULL;
+            }
+
+            expr_integrand(&expr, &integrand);
+            expression = 1;
+        }
+    } else if (PyCallable_Check(f)) {
+        cb.func = f;
+
+        // NumPy is optional, callables get a memoryview without it
+        PyObject *numpy = PyImport_ImportModule("numpy");
+        if (numpy) {
+            cb.frombuffer = PyObject_GetAttrString(numpy, "frombuffer");
+            Py_DECREF(numpy);
+        }
+        PyErr_Clear();
+
+        integrand.eval = callback_eval;
+        integrand.data = &cb;
+    } else {
+        PyErr_SetString(PyExc_TypeError, "f must be a callable or the name of a built-in integrand");
+        return NULL;
+    }
+
+    // integrate ignores a bad SOLVER_COST, SOLVER_IDLE or SOLVER_BALANCE, so
+    // raise here instead
+    enum CostMode cost_mode;
+    enum IdleMode idle_mode;
+    bool pushing;
+    if (!cost_mode_parse(&integrand, &cost_mode))
+        PyErr_Format(PyExc_ValueError, "invalid SOLVER_COST '%s' for this integrand", getenv("SOLVER_COST"));
+    else if (!idle_mode_parse(&idle_mode))
+        PyErr_Format(PyExc_ValueError, "unknown SOLVER_IDLE mode '%s'", getenv("SOLVER_IDLE"));
+    else if (!balance_parse(&pushing))
+        PyErr_Format(PyExc_ValueError, "unknown SOLVER_BALANCE '%s'", getenv("SOLVER_BALANCE"));
+
+    if (PyErr_Occurred()) {
+        Py_XDECREF(cb.frombuffer);
+        if (expression)
+            expr_destroy(&expr);
+        return NULL;
+    }
+
+    double quad;
+
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(solver_lock, WAIT_LOCK);
+    int max_threads = omp_get_max_threads();
+    if (threads > 0)
+        omp_set_num_threads(threads);
+    quad = integrate(&integrand, left, right, tol, NULL);
+    omp_set_num_threads(max_threads);
+    PyThread_release_lock(solver_lock);
+    Py_END_ALLOW_THREADS
+
+    Py_XDECREF(cb.frombuffer);
+
+    if (expression)
+        expr_destroy(&expr);
+
+    if (cb.failed) {
+        PyErr_Restore(cb.type, cb.value, cb.traceback);
+        return NULL;
+    }
+
+    return PyFloat_FromDouble(quad);
+}
+
+static PyObject *solver_builtins(PyObject *self, PyObject *unused)
+{
+    (void)self;
+    (void)unused;
+
+    size_t count = sizeof(builtins) / sizeof(builtins[0]);
+    PyObject *names = PyTuple_New(count);
+    if (!names)
+        return NULL;
+
+    for (size_t i = 0; i < count; i++)
+        PyTuple_SET_ITEM(names, i, PyUnicode_FromString(builtins[i].name));
+
+    return names;
+}
+
+static PyMethodDef solver_methods[] = {
+    { "integrate", (PyCFunction)(void (*)(void))solver_integrate, METH_VARARGS | METH_KEYWORDS,
+      "integrate(f, left, right, tol=1e-06, threads=0, native=True)\n\n"
+      "Integrate f over [left, right] with the separate queue solver. f is either\n"
+      "the name of a built-in integrand, an expression in x such as\n"
+      "'euler(0, 0.0001, 100000 * sin(x * 100000), 200 * x)', or a callable that\n"
+      "maps an array of abscissae to an array of function values. The array passed\n"
+      "to f is only valid during the call. threads > 0 sets the OpenMP team size.\n"
+      "Expressions are compiled to native code, or interpreted if native is False\n"
+      "or compiling fails." },
+    { "builtins", solver_builtins, METH_NOARGS,
+      "builtins()\n\nReturn the names of the built-in integrands." },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef solver_module = {
+    PyModuleDef_HEAD_INIT, "solver", "Adaptive quadrature solver bindings", -1, solver_methods,
+    NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_solver(void)
+{
+    solver_lock = PyThread_allocate_lock();
+    if (!solver_lock)
+        return PyErr_NoMemory();
+
+    return PyModule_Create(&solver_module);
+}
@@ -0,0 +1,653 @@
+// Globally adaptive Gauss-Kronrod integration transcribed from QUADPACK
+// (R. Piessens, E. de Doncker-Kapenga, C. Ueberhuber and D. Kahaner, public
+// domain) routines dqk21, dqage, dqagse, dqpsrt and dqelg. The integrand is
+// evaluated in batches of 21 points, one batch per rule application. dqpsrt's
+// ordered list is kept as a sorted array, or a heap where only the largest
+// error is needed, and is not truncated once few subdivisions remain.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+
+#include "quadpack.h"
+
+#define EPMACH DBL_EPSILON
+#define UFLOW  DBL_MIN
+#define OFLOW  DBL_MAX
+
+// Size of the epsilon table, QUADPACK's limexp + 2
+#define LIMEXP 50
+
+// Abscissae of the 21 point Kronrod rule, xgk[1], xgk[3], ... are the
+// abscissae of the 10 point Gauss rule
+static const double xgk[11] = {
+    0.995657163025808080735527280689003, 0.973906528517171720077964012084452,
+    0.930157491355708226001207180059508, 0.865063366688984510732096688423493,
+    0.780817726586416897063717578345042, 0.679409568299024406234327365114874,
+    0.562757134668604683339000099272694, 0.433395394129247190799265943165784,
+    0.294392862701460198131126603103866, 0.148874338981631210884826001129720,
+    0.000000000000000000000000000000000
+};
+
+// Weights of the 21 point Kronrod rule
+static const double wgk[11] = {
+    0.011694638867371874278064396062192, 0.032558162307964727478818972459390,
+    0.054755896574351996031381300244580, 0.075039674810919952767043140916190,
+    0.093125454583697605535065465083366, 0.109387158802297641899210590325805,
+    0.123491976262065851077208980491660, 0.134709217311473325928054001771707,
+    0.142775938577060080797094273138717, 0.147739104901338491374841515972068,
+    0.149445554002916905664936468389821
+};
+
+// Weights of the 10 point Gauss rule
+static const double wg[5] = {
+    0.066671344308688137593568809893332, 0.149451349150580593145776339657697,
+    0.219086362515982043995534934228163, 0.269266719309996355091226921569469,
+    0.295524224714752870173892994651338
+};
+
+// 21 point Gauss-Kronrod rule on [a, b]. resabs approximates the integral of
+// |f| and resasc the integral of |f - mean|.
+static void qk21(const struct Integrand *f, double a, double b, double *result, double *abserr,
+                 double *resabs, double *resasc)
+{
+    double centr = 0.5 * (a + b);
+    double hlgth = 0.5 * (b - a);
+    double dhlgth = fabs(hlgth);
+
+    double x[21], fx[21];
+    x[0] = centr;
+    for (int j = 0; j < 10; ++j) {
+        double absc = hlgth * xgk[j];
+        x[1 + 2 * j] = centr - absc;
+        x[2 + 2 * j] = centr + absc;
+    }
+
+    f->eval(x, fx, 21, f->data);
+
+    double fc = fx[0];
+    double resg = 0.0;
+    double resk = wgk[10] * fc;
+    *resabs = fabs(resk);
+
+    for (int j = 0; j < 10; ++j) {
+        double fsum = fx[1 + 2 * j] + fx[2 + 2 * j];
+        resk += wgk[j] * fsum;
+        *resabs += wgk[j] * (fabs(fx[1 + 2 * j]) + fabs(fx[2 + 2 * j]));
+        if (j % 2 == 1)
+            resg += wg[j / 2] * fsum;
+    }
+
+    double reskh = resk * 0.5;
+    *resasc = wgk[10] * fabs(fc - reskh);
+    for (int j = 0; j < 10; ++j) {
+        *resasc += wgk[j] * (fabs(fx[1 + 2 * j] - reskh) + fabs(fx[2 + 2 * j] - reskh));
+    }
+
+    *result = resk * hlgth;
+    *resabs *= dhlgth;
+    *resasc *= dhlgth;
+    *abserr = fabs((resk - resg) * hlgth);
+
+    if (*resasc != 0.0 && *abserr != 0.0)
+        *abserr = *resasc * fmin(1.0, pow(200.0 * *abserr / *resasc, 1.5));
+    if (*resabs > UFLOW / (50.0 * EPMACH))
+        *abserr = fmax(EPMACH * 50.0 * *resabs, *abserr);
+}
+
+// Subintervals with their results and error estimates, and the order in
+// which they are bisected
+struct List {
+    double *alist, *blist, *rlist, *elist;
+    int *iord;
+    int last;  // number of subintervals
+};
+
+static void list_init(struct List *list, int limit)
+{
+    list->alist = (double *)malloc(sizeof(double) * limit);
+    list->blist = (double *)malloc(sizeof(double) * limit);
+    list->rlist = (double *)malloc(sizeof(double) * limit);
+    list->elist = (double *)malloc(sizeof(double) * limit);
+    list->iord = (int *)malloc(sizeof(int) * limit);
+    if (!list->alist || !list->blist || !list->rlist || !list->elist || !list->iord) {
+        printf("Failed to allocate QUADPACK subintervals - exiting\n");
+        exit(1);
+    }
+    list->last = 0;
+}
+
+static void list_destroy(struct List *list)
+{
+    free(list->alist);
+    free(list->blist);
+    free(list->rlist);
+    free(list->elist);
+    free(list->iord);
+}
+
+// Bisect subinterval maxerr, keeping the half with the larger error in its
+// place and appending the other
+static void bisect(const struct Integrand *f, struct List *list, int maxerr, double *area12, double *erro12,
+                   double *error1, double *error2, double *defab1, double *defab2, double *a1, double *b2,
+                   double *a2, double *old)
+{
+    double area1, area2, resabs;
+
+    *a1 = list->alist[maxerr];
+    double b1 = 0.5 * (list->alist[maxerr] + list->blist[maxerr]);
+    *a2 = b1;
+    *b2 = list->blist[maxerr];
+
+    qk21(f, *a1, b1, &area1, error1, &resabs, defab1);
+    qk21(f, *a2, *b2, &area2, error2, &resabs, defab2);
+
+    *area12 = area1 + area2;
+    *erro12 = *error1 + *error2;
+    *old = list->rlist[maxerr];
+
+    int last = list->last++;
+
+    if (*error2 > *error1) {
+        list->alist[maxerr] = *a2;
+        list->alist[last] = *a1;
+        list->blist[last] = b1;
+        list->rlist[maxerr] = area2;
+        list->rlist[last] = area1;
+        list->elist[maxerr] = *error2;
+        list->elist[last] = *error1;
+    } else {
+        list->alist[last] = *a2;
+        list->blist[maxerr] = b1;
+        list->blist[last] = *b2;
+        list->rlist[maxerr] = area1;
+        list->rlist[last] = area2;
+        list->elist[maxerr] = *error1;
+        list->elist[last] = *error2;
+    }
+}
+
+static double list_sum(const struct List *list)
+{
+    double sum = 0.0;
+    for (int k = 0; k < list->last; ++k) {
+        sum += list->rlist[k];
+    }
+    return sum;
+}
+
+// Restore the heap of the first n subintervals after the error of the one at
+// position i decreased
+static void heap_down(struct List *list, int n, int i)
+{
+    int *heap = list->iord;
+
+    while (1) {
+        int largest = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < n && list->elist[heap[l]] > list->elist[heap[largest]])
+            largest = l;
+        if (r < n && list->elist[heap[r]] > list->elist[heap[largest]])
+            largest = r;
+        if (largest == i)
+            break;
+        int swap = heap[i];
+        heap[i] = heap[largest];
+        heap[largest] = swap;
+        i = largest;
+    }
+}
+
+static void heap_up(struct List *list, int i)
+{
+    int *heap = list->iord;
+
+    while (i > 0 && list->elist[heap[i]] > list->elist[heap[(i - 1) / 2]]) {
+        int swap = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = swap;
+        i = (i - 1) / 2;
+    }
+}
+
+void qag(const struct Integrand *f, double a, double b, double epsabs, double epsrel, int limit,
+         struct Quadpack *out)
+{
+    assert(f && out && limit > 0);
+
+    struct List list;
+    list_init(&list, limit);
+
+    double result, abserr, defabs, resabs;
+    int ier = 0;
+
+    qk21(f, a, b, &result, &abserr, &defabs, &resabs);
+
+    list.alist[0] = a;
+    list.blist[0] = b;
+    list.rlist[0] = result;
+    list.elist[0] = abserr;
+    list.iord[0] = 0;
+    list.last = 1;
+
+    double errbnd = fmax(epsabs, epsrel * fabs(result));
+    if (abserr <= 50.0 * EPMACH * defabs && abserr > errbnd)
+        ier = 2;
+    if (limit == 1)
+        ier = 1;
+
+    if (!(ier != 0 || (abserr <= errbnd && abserr != resabs) || abserr == 0.0)) {
+        double area = result, errsum = abserr;
+        int iroff1 = 0, iroff2 = 0;
+
+        while (list.last < limit) {
+            // The subinterval with the largest error is at the top of the heap
+            int maxerr = list.iord[0];
+            double errmax = list.elist[maxerr];
+            double area12, erro12, error1, error2, defab1, defab2, a1, b2, a2, old;
+
+            bisect(f, &list, maxerr, &area12, &erro12, &error1, &error2, &defab1, &defab2, &a1, &b2, &a2, &old);
+
+            errsum += erro12 - errmax;
+            area += area12 - old;
+
+            if (defab1 != error1 && defab2 != error2) {
+                if (fabs(old - area12) <= 1.0e-5 * fabs(area12) && erro12 >= 0.99 * errmax)
+                    iroff1++;
+                if (list.last > 10 && erro12 > errmax)
+                    iroff2++;
+            }
+
+            errbnd = fmax(epsabs, epsrel * fabs(area));
+            if (errsum > errbnd) {
+                // Roundoff, too many subdivisions or a bad integrand
+                if (iroff1 >= 6 || iroff2 >= 20)
+                    ier = 2;
+                if (list.last == limit)
+                    ier = 1;
+                if (fmax(fabs(a1), fabs(b2)) <= (1.0 + 100.0 * EPMACH) * (fabs(a2) + 1000.0 * UFLOW))
+                    ier = 3;
+            }
+
+            heap_down(&list, list.last - 1, 0);
+            list.iord[list.last - 1] = list.last - 1;
+            heap_up(&list, list.last - 1);
+
+            if (ier != 0 || errsum <= errbnd)
+                break;
+        }
+
+        result = list_sum(&list);
+        abserr = errsum;
+    }
+
+    out->result = result;
+    out->abserr = abserr;
+    out->evaluations = 42L * list.last - 21;
+    out->intervals = list.last;
+    out->ier = ier;
+
+    list_destroy(&list);
+}
+
+// Index of the first entry of the descending list iord[0..count-1] with an
+// error below err
+static int position(const struct List *list, int count, double err)
+{
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (list->elist[list->iord[mid]] >= err)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void insert(struct List *list, int count, int index)
+{
+    int p = position(list, count, list->elist[index]);
+    memmove(&list->iord[p + 1], &list->iord[p], sizeof(int) * (count - p));
+    list->iord[p] = index;
+}
+
+// dqpsrt: keep iord in descending order of error after subinterval maxerr,
+// which was at position nrmax, was bisected into maxerr and the last
+// subinterval. Returns the subinterval at position nrmax, where nrmax moves
+// up if maxerr's error grew above the subintervals before it.
+static int qpsrt(struct List *list, int maxerr, int *nrmax)
+{
+    int last = list->last;
+
+    if (last <= 2) {
+        list->iord[0] = 0;
+        list->iord[1] = 1;
+        return list->iord[*nrmax - 1];
+    }
+
+    int old = *nrmax - 1;
+    assert(list->iord[old] == maxerr);
+
+    double errmax = list->elist[maxerr];
+    while (*nrmax > 1 && errmax > list->elist[list->iord[*nrmax - 2]]) {
+        (*nrmax)--;
+    }
+
+    // Remove maxerr from its old position and insert both halves
+    memmove(&list->iord[old], &list->iord[old + 1], sizeof(int) * (last - 2 - old));
+
+    insert(list, last - 2, maxerr);
+    insert(list, last - 1, last - 1);
+
+    return list->iord[*nrmax - 1];
+}
+
+// dqelg: epsilon algorithm. epstab holds the n results so far and receives
+// the extrapolated limit in result, res3la the last three limits.
+static void qelg(int *n, double *epstab, double *result, double *abserr, double *res3la, int *nres)
+{
+    (*nres)++;
+    *abserr = OFLOW;
+    *result = epstab[*n - 1];
+
+    if (*n < 3) {
+        *abserr = fmax(*abserr, 5.0 * EPMACH * fabs(*result));
+        return;
+    }
+
+    epstab[*n + 1] = epstab[*n - 1];
+    int newelm = (*n - 1) / 2;
+    epstab[*n - 1] = OFLOW;
+    int num = *n;
+    int k1 = *n;
+
+    for (int i = 1; i <= newelm; ++i) {
+        int k2 = k1 - 1;
+        int k3 = k1 - 2;
+        double res = epstab[k1 + 1];
+        double e0 = epstab[k3 - 1];
+        double e1 = epstab[k2 - 1];
+        double e2 = res;
+        double e1abs = fabs(e1);
+        double delta2 = e2 - e1;
+        double err2 = fabs(delta2);
+        double tol2 = fmax(fabs(e2), e1abs) * EPMACH;
+        double delta3 = e1 - e0;
+        double err3 = fabs(delta3);
+        double tol3 = fmax(e1abs, fabs(e0)) * EPMACH;
+
+        if (err2 <= tol2 && err3 <= tol3) {
+            // e0, e1 and e2 are equal to within machine accuracy, so
+            // convergence is assumed
+            *result = res;
+            *abserr = fmax(err2 + err3, 5.0 * EPMACH * fabs(*result));
+            return;
+        }
+
+        double e3 = epstab[k1 - 1];
+        epstab[k1 - 1] = e1;
+        double delta1 = e1 - e3;
+        double err1 = fabs(delta1);
+        double tol1 = fmax(e1abs, fabs(e3)) * EPMACH;
+
+        // Two elements are very close, omit part of the table
+        if (err1 <= tol1 || err2 <= tol2 || err3 <= tol3) {
+            *n = i + i - 1;
+            break;
+        }
+
+        double ss = 1.0 / delta1 + 1.0 / delta2 - 1.0 / delta3;
+        double epsinf = fabs(ss * e1);
+
+        // Test to detect irregular behaviour in the table
+        if (epsinf <= 1.0e-4) {
+            *n = i + i - 1;
+            break;
+        }
+
+        res = e1 + 1.0 / ss;
+        epstab[k1 - 1] = res;
+        k1 -= 2;
+
+        double error = err2 + fabs(res - e2) + err3;
+        if (error <= *abserr) {
+            *abserr = error;
+            *result = res;
+        }
+    }
+
+    // Shift the table
+    if (*n == LIMEXP)
+        *n = 2 * (LIMEXP / 2) - 1;
+
+    int ib = (num % 2 == 1) ? 1 : 2;
+    int ie = newelm + 1;
+    for (int i = 1; i <= ie; ++i) {
+        epstab[ib - 1] = epstab[ib + 1];
+        ib += 2;
+    }
+
+    if (num != *n) {
+        int indx = num - *n + 1;
+        for (int i = 1; i <= *n; ++i) {
+            epstab[i - 1] = epstab[indx - 1];
+            indx++;
+        }
+    }
+
+    if (*nres < 4) {
+        res3la[*nres - 1] = *result;
+        *abserr = OFLOW;
+    } else {
+        *abserr = fabs(*result - res3la[2]) + fabs(*result - res3la[1]) + fabs(*result - res3la[0]);
+        res3la[0] = res3la[1];
+        res3la[1] = res3la[2];
+        res3la[2] = *result;
+    }
+
+    *abserr = fmax(*abserr, 5.0 * EPMACH * fabs(*result));
+}
+
+void qags(const struct Integrand *f, double a, double b, double epsabs, double epsrel, int limit,
+          struct Quadpack *out)
+{
+    assert(f && out && limit > 0);
+
+    struct List list;
+    list_init(&list, limit);
+
+    double result, abserr, defabs, resabs;
+    int ier = 0, ierro = 0;
+
+    qk21(f, a, b, &result, &abserr, &defabs, &resabs);
+
+    list.alist[0] = a;
+    list.blist[0] = b;
+    list.rlist[0] = result;
+    list.elist[0] = abserr;
+    list.iord[0] = 0;
+    list.last = 1;
+
+    double dres = fabs(result);
+    double errbnd = fmax(epsabs, epsrel * dres);
+    if (abserr <= 100.0 * EPMACH * defabs && abserr > errbnd)
+        ier = 2;
+    if (limit == 1)
+        ier = 1;
+
+    if (ier != 0 || (abserr <= errbnd && abserr != resabs) || abserr == 0.0)
+        goto done;
+
+    double rlist2[LIMEXP + 2], res3la[3];
+    rlist2[0] = result;
+
+    double errmax = abserr, area = result, errsum = abserr;
+    double small = 0.0, erlarg = 0.0, ertest = 0.0, correc = 0.0;
+    int maxerr = 0, nrmax = 1, nres = 0, numrl2 = 2, ktmin = 0;
+    int iroff1 = 0, iroff2 = 0, iroff3 = 0;
+    bool extrap = false, noext = false;
+    abserr = OFLOW;
+
+    int ksgn = (dres >= (1.0 - 50.0 * EPMACH) * defabs) ? 1 : -1;
+
+    while (list.last < limit) {
+        double area12, erro12, error1, error2, defab1, defab2, a1, b2, a2, old;
+        double erlast = errmax;
+
+        bisect(f, &list, maxerr, &area12, &erro12, &error1, &error2, &defab1, &defab2, &a1, &b2, &a2, &old);
+
+        errsum += erro12 - errmax;
+        area += area12 - old;
+
+        if (defab1 != error1 && defab2 != error2) {
+            if (fabs(old - area12) <= 1.0e-5 * fabs(area12) && erro12 >= 0.99 * errmax) {
+                if (extrap)
+                    iroff2++;
+                else
+                    iroff1++;
+            }
+            if (list.last > 10 && erro12 > errmax)
+                iroff3++;
+        }
+
+        errbnd = fmax(epsabs, epsrel * fabs(area));
+
+        if (iroff1 + iroff2 >= 10 || iroff3 >= 20)
+            ier = 2;
+        if (iroff2 >= 5)
+            ierro = 3;
+        if (list.last == limit)
+            ier = 1;
+        if (fmax(fabs(a1), fabs(b2)) <= (1.0 + 100.0 * EPMACH) * (fabs(a2) + 1000.0 * UFLOW))
+            ier = 4;
+
+        maxerr = qpsrt(&list, maxerr, &nrmax);
+        errmax = list.elist[maxerr];
+
+        if (errsum <= errbnd)
+            goto sum;
+        if (ier != 0)
+            break;
+
+        if (list.last == 2) {
+            small = fabs(b - a) * 0.375;
+            erlarg = errsum;
+            ertest = errbnd;
+            rlist2[1] = area;
+            continue;
+        }
+
+        if (noext)
+            continue;
+
+        erlarg -= erlast;
+        if (fabs(a2 - a1) > small)
+            erlarg += erro12;
+
+        if (!extrap) {
+            // Test whether the interval to be bisected next is the smallest
+            if (fabs(list.blist[maxerr] - list.alist[maxerr]) > small)
+                continue;
+            extrap = true;
+            nrmax = 2;
+        }
+
+        if (ierro != 3 && erlarg > ertest) {
+            // Bisect the large intervals first, the smallest ones are only
+            // bisected once all others have been
+            bool large = false;
+            for (int k = nrmax; k <= list.last; ++k) {
+                maxerr = list.iord[nrmax - 1];
+                errmax = list.elist[maxerr];
+                if (fabs(list.blist[maxerr] - list.alist[maxerr]) > small) {
+                    large = true;
+                    break;
+                }
+                nrmax++;
+            }
+            if (large)
+                continue;
+        }
+
+        // Perform extrapolation
+        numrl2++;
+        rlist2[numrl2 - 1] = area;
+
+        double reseps, abseps;
+        qelg(&numrl2, rlist2, &reseps, &abseps, res3la, &nres);
+
+        ktmin++;
+        if (ktmin > 5 && abserr < 1.0e-3 * errsum)
+            ier = 5;
+
+        if (abseps < abserr) {
+            ktmin = 0;
+            abserr = abseps;
+            result = reseps;
+            correc = erlarg;
+            ertest = fmax(epsabs, epsrel * fabs(reseps));
+            if (abserr <= ertest)
+                break;
+        }
+
+        // Prepare bisection of the smallest interval
+        if (numrl2 == 1)
+            noext = true;
+        if (ier == 5)
+            break;
+
+        maxerr = list.iord[0];
+        errmax = list.elist[maxerr];
+        nrmax = 1;
+        extrap = false;
+        small *= 0.5;
+        erlarg = errsum;
+    }
+
+    // Set the final result and error estimate
+    if (abserr == OFLOW)
+        goto sum;
+
+    if (ier + ierro != 0) {
+        if (ierro == 3)
+            abserr += correc;
+        if (ier == 0)
+            ier = 3;
+        if (result != 0.0 && area != 0.0) {
+            if (abserr / fabs(result) > errsum / fabs(area))
+                goto sum;
+        } else if (abserr > errsum) {
+            goto sum;
+        } else if (area == 0.0) {
+            goto adjust;
+        }
+    }
+
+    // Test on divergence
+    if (!(ksgn == -1 && fmax(fabs(result), fabs(area)) <= defabs * 0.01)) {
+        if (0.01 > result / area || result / area > 100.0 || errsum > fabs(area))
+            ier = 6;
+    }
+    goto adjust;
+
+sum:
+    result = list_sum(&list);
+    abserr = errsum;
+
+adjust:
+    if (ier > 2)
+        ier--;
+
+done:
+    out->result = result;
+    out->abserr = abserr;
+    out->evaluations = 42L * list.last - 21;
+    out->intervals = list.last;
+    out->ier = ier;
+
+    list_destroy(&list);
+}
@@ -0,0 +1,26 @@
+#ifndef QUADPACK_H
+#define QUADPACK_H
+
+#include "function.h"
+
+// Outcome of a QUADPACK integration
+struct Quadpack {
+    double result;    // approximation to the integral
+    double abserr;    // estimate of the absolute error
+    long evaluations; // number of integrand evaluations
+    int intervals;    // number of subintervals produced
+    int ier;          // QUADPACK error code, 0 on success
+};
+
+// Globally adaptive integration with the 21 point Gauss-Kronrod rule,
+// following QUADPACK's dqage with key = 2. Stops once the summed error
+// estimate is below max(epsabs, epsrel * |result|) or after limit intervals.
+void qag(const struct Integrand *, double a, double b, double epsabs, double epsrel, int limit,
+         struct Quadpack *);
+
+// As qag, with the epsilon algorithm extrapolating the sequence of results to
+// handle endpoint singularities, following QUADPACK's dqagse
+void qags(const struct Integrand *, double a, double b, double epsabs, double epsrel, int limit,
+          struct Quadpack *);
+
+#endif
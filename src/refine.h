@@ -0,0 +1,36 @@
+#ifndef REFINE_H
+#define REFINE_H
+
+#include <math.h>
+#include <float.h>
+#include <stdbool.h>
+
+// Intervals narrower than this many ulps of their ends are not split. Their
+// quarter points are then still at least 16 ulps from the ends.
+#define REFINE_MINULPS 64.0
+
+// Bound on the rounding error of q2 - q1 in units of the relative error of the
+// function values times the weighted sum of their magnitudes
+#define REFINE_NOISE 4.0
+
+// Whether splitting [left, right] further cannot resolve the difference
+// between the 3 and 5 point estimates, replacing an absolute floor on the
+// width that is millions of ulps near 0 and less than one beyond 1e4. Either
+// the interval is within REFINE_MINULPS ulps of the scale of its ends, or
+// q2 - q1 is within the noise of the function values fl, fd, fm, fe and fr,
+// whose relative error is noise, or DBL_EPSILON when noise is 0.
+static inline bool unresolvable(double left, double right, double fl, double fd, double fm, double fe, double fr,
+                                double q1, double q2, double noise)
+{
+    double h = right - left;
+    double scale = fmax(fmax(fabs(left), fabs(right)), DBL_MIN);
+
+    if (h <= REFINE_MINULPS * DBL_EPSILON * scale)
+        return true;
+
+    double magnitude = h / 12.0 * (fabs(fl) + 4.0 * fabs(fd) + 2.0 * fabs(fm) + 4.0 * fabs(fe) + fabs(fr));
+
+    return fabs(q2 - q1) <= REFINE_NOISE * (noise > 0.0 ? noise : DBL_EPSILON) * magnitude;
+}
+
+#endif
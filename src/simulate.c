@@ -0,0 +1,1106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "function.h"
+#include "refine.h"
+
+// Core counts simulated by default
+static const int default_cores[] = { 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+
+// Refinement tree of an integration in preorder. The left child of node i is
+// node i + 1, and right[i] is its right child or -1 if the interval was
+// accepted. cost[i] is the cost of the node's two evaluations in func1_cost
+// units, and unit_ns the measured time of one unit.
+struct Tree {
+    long nodes;
+    long capacity;
+    float *cost;
+    int32_t *right;
+    double unit_ns;   // nanoseconds per cost unit
+    double prologue;  // cost units of the initial three evaluations
+};
+
+struct TraceHeader {
+    char magic[8];
+    long nodes;
+    double unit_ns;
+    double prologue;
+};
+
+static const char magic[8] = "SIMTREE";
+
+void tree_grow(struct Tree *tree)
+{
+    if (tree->nodes < tree->capacity)
+        return;
+
+    tree->capacity = tree->capacity ? 2 * tree->capacity : 1 << 20;
+    tree->cost = (float *)realloc(tree->cost, sizeof(float) * tree->capacity);
+    tree->right = (int32_t *)realloc(tree->right, sizeof(int32_t) * tree->capacity);
+    if (!tree->cost || !tree->right || tree->capacity > INT32_MAX) {
+        printf("Failed to allocate tree - exiting\n");
+        exit(1);
+    }
+}
+
+// Serial adaptive Simpson recording every interval it evaluates. It refines
+// the same intervals as all solvers.
+void record(struct Tree *tree, double left, double right, double tol, double f_left, double f_mid, double f_right)
+{
+    tree_grow(tree);
+    long node = tree->nodes++;
+
+    double h = right - left;
+    double c = (left + right) / 2.0;
+    double d = (left + c) / 2.0;
+    double e = (c + right) / 2.0;
+    double fd = func1(d);
+    double fe = func1(e);
+
+    tree->cost[node] = (float)(func1_cost(d) + func1_cost(e));
+
+    double q1 = h / 6.0  * (f_left + 4.0 * f_mid + f_right);
+    double q2 = h / 12.0 * (f_left + 4.0 * fd + 2.0 * f_mid + 4.0 * fe + f_right);
+
+    if ((fabs(q2 - q1) < tol) ||
+        unresolvable(left, right, f_left, fd, f_mid, fe, f_right, q1, q2, FUNC1_NOISE)) {
+        tree->right[node] = -1;
+    } else {
+        record(tree, left, c, tol, f_left, fd, f_mid);
+        tree->right[node] = (int32_t)tree->nodes;
+        record(tree, c, right, tol, f_mid, fe, f_right);
+    }
+}
+
+void write_trace(const char *path, double left, double right, double tol)
+{
+    struct Tree tree;
+    memset(&tree, 0, sizeof(tree));
+
+    double start = omp_get_wtime();
+
+    tree.prologue = func1_cost(left) + func1_cost(right) + func1_cost((left + right) / 2.0);
+    record(&tree, left, right, tol, func1(left), func1((left + right) / 2.0), func1(right));
+
+    double elapsed = omp_get_wtime() - start;
+
+    // The serial run calibrates the cost units, including the arithmetic and
+    // bookkeeping of each node
+    double units = tree.prologue;
+    for (long i = 0; i < tree.nodes; ++i) {
+        units += tree.cost[i];
+    }
+    tree.unit_ns = elapsed * 1e9 / units;
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        printf("Failed to open trace file %s - exiting\n", path);
+        exit(1);
+    }
+
+    struct TraceHeader header;
+    memcpy(header.magic, magic, sizeof(magic));
+    header.nodes = tree.nodes;
+    header.unit_ns = tree.unit_ns;
+    header.prologue = tree.prologue;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(tree.cost, sizeof(float), tree.nodes, file) != (size_t)tree.nodes ||
+        fwrite(tree.right, sizeof(int32_t), tree.nodes, file) != (size_t)tree.nodes) {
+        printf("Failed to write trace file %s - exiting\n", path);
+        exit(1);
+    }
+
+    fclose(file);
+
+    printf("Nodes = %ld\n", tree.nodes);
+    printf("Evaluations = %ld\n", 3 + 2 * tree.nodes);
+    printf("Time(s) = %f\n", elapsed);
+    printf("Cost unit(ns) = %f\n", tree.unit_ns);
+
+    free(tree.cost);
+    free(tree.right);
+}
+
+void read_trace(const char *path, struct Tree *tree)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        printf("Failed to open trace file %s - exiting\n", path);
+        exit(1);
+    }
+
+    struct TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, magic, sizeof(magic)) != 0) {
+        printf("%s is not a trace file - exiting\n", path);
+        exit(1);
+    }
+
+    memset(tree, 0, sizeof(*tree));
+    tree->capacity = header.nodes;
+    tree->nodes = header.nodes;
+    tree->unit_ns = header.unit_ns;
+    tree->prologue = header.prologue;
+    tree->cost = (float *)malloc(sizeof(float) * header.nodes);
+    tree->right = (int32_t *)malloc(sizeof(int32_t) * header.nodes);
+    if (!tree->cost || !tree->right) {
+        printf("Failed to allocate tree - exiting\n");
+        exit(1);
+    }
+
+    if (fread(tree->cost, sizeof(float), tree->nodes, file) != (size_t)tree->nodes ||
+        fread(tree->right, sizeof(int32_t), tree->nodes, file) != (size_t)tree->nodes) {
+        printf("Truncated trace file %s - exiting\n", path);
+        exit(1);
+    }
+
+    fclose(file);
+}
+
+//
+// Discrete event simulation. Each simulated thread has exactly one pending
+// event, kept in a heap ordered by time.
+//
+
+enum Event {
+    EV_LOCK,   // request the lock of the queue to take an interval
+    EV_TAKE,   // holding the lock, take an interval
+    EV_DONE,   // finished evaluating an interval
+    EV_PUSH,   // holding the lock, queue the children
+    EV_PUSH2,  // holding the lock, spawn or queue the second child
+    EV_PROBE,  // try the lock of the next victim queue
+    EV_STOLEN  // holding the victim's lock, take an interval
+};
+
+// Timings of the modelled machine in seconds
+struct Latency {
+    double lock;   // uncontended lock, operation and unlock on a local queue
+    double steal;  // test of a remote lock, or operation on a remote queue
+    double task;   // creating a task or waking a sleeping thread
+};
+
+struct Stack {
+    int32_t *entry;
+    long top;
+    long capacity;
+};
+
+struct Sim {
+    const struct Tree *tree;
+    struct Latency latency;
+    int threads;
+
+    // Pending events, one per thread
+    double *time;
+    enum Event *event;
+    int *heap;
+    int heap_size;
+
+    // Per thread state
+    int32_t *node;     // interval being evaluated
+    int *attempt;      // steal attempt within the current round
+    int *victim;       // queue being stolen from
+    int *first;        // queue to probe before the round, or -1
+    bool *waiting;     // asleep until work appears
+    bool *exited;
+
+    struct Stack *stacks;
+    double *lock_free; // time each queue lock becomes free
+    int queue_count;
+
+    // Estimated cost of each node and of each queue's nodes, when modelling
+    // longest processing time first scheduling
+    double *estimate;
+    double *queue_cost;
+
+    uint64_t random;   // xorshift state for picking queues
+
+    int active;        // threads evaluating an interval
+    long queued;       // intervals in all queues
+    double end;        // time the last thread left
+};
+
+static void stack_push(struct Stack *stack, int32_t node)
+{
+    if (stack->top + 1 == stack->capacity) {
+        stack->capacity = stack->capacity ? 2 * stack->capacity : 1024;
+        stack->entry = (int32_t *)realloc(stack->entry, sizeof(int32_t) * stack->capacity);
+        if (!stack->entry) {
+            printf("Failed to allocate simulated queue - exiting\n");
+            exit(1);
+        }
+    }
+
+    stack->entry[++stack->top] = node;
+}
+
+static int32_t stack_pop(struct Stack *stack)
+{
+    assert(stack->top >= 0);
+    return stack->entry[stack->top--];
+}
+
+static bool stack_empty(const struct Stack *stack)
+{
+    return stack->top == -1;
+}
+
+static bool earlier(const struct Sim *sim, int a, int b)
+{
+    return sim->time[a] < sim->time[b] || (sim->time[a] == sim->time[b] && a < b);
+}
+
+static void heap_up(struct Sim *sim, int i)
+{
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!earlier(sim, sim->heap[i], sim->heap[parent]))
+            break;
+        int swap = sim->heap[i];
+        sim->heap[i] = sim->heap[parent];
+        sim->heap[parent] = swap;
+        i = parent;
+    }
+}
+
+static void heap_down(struct Sim *sim, int i)
+{
+    while (1) {
+        int smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < sim->heap_size && earlier(sim, sim->heap[l], sim->heap[smallest]))
+            smallest = l;
+        if (r < sim->heap_size && earlier(sim, sim->heap[r], sim->heap[smallest]))
+            smallest = r;
+        if (smallest == i)
+            break;
+        int swap = sim->heap[i];
+        sim->heap[i] = sim->heap[smallest];
+        sim->heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+// Give a thread without a pending event its next event
+static void schedule(struct Sim *sim, int thread, enum Event event, double time)
+{
+    sim->time[thread] = time;
+    sim->event[thread] = event;
+    sim->heap[sim->heap_size] = thread;
+    heap_up(sim, sim->heap_size++);
+}
+
+static int next_event(struct Sim *sim)
+{
+    int thread = sim->heap[0];
+    sim->heap[0] = sim->heap[--sim->heap_size];
+    heap_down(sim, 0);
+    return thread;
+}
+
+// Acquire a queue lock at time, returns when the critical section of the
+// given length is over. Requests are served in the order they are made.
+static double lock(struct Sim *sim, int queue, double time, double length)
+{
+    double granted = (sim->lock_free[queue] > time) ? sim->lock_free[queue] : time;
+    sim->lock_free[queue] = granted + length;
+    return granted + length;
+}
+
+static double node_time(const struct Sim *sim, int32_t node)
+{
+    return sim->tree->cost[node] * sim->tree->unit_ns * 1e-9;
+}
+
+static void leave(struct Sim *sim, int thread, double time)
+{
+    sim->exited[thread] = true;
+    if (time > sim->end)
+        sim->end = time;
+}
+
+static void start_node(struct Sim *sim, int thread, int32_t node, double time)
+{
+    sim->node[thread] = node;
+    sim->active++;
+    sim->queued--;
+    schedule(sim, thread, EV_DONE, time + node_time(sim, node));
+}
+
+void sim_init(struct Sim *sim, const struct Tree *tree, struct Latency latency, int threads, int queue_count)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->tree = tree;
+    sim->latency = latency;
+    sim->threads = threads;
+    sim->queue_count = queue_count;
+
+    sim->time = (double *)calloc(threads, sizeof(double));
+    sim->event = (enum Event *)calloc(threads, sizeof(enum Event));
+    sim->heap = (int *)calloc(threads, sizeof(int));
+    sim->node = (int32_t *)calloc(threads, sizeof(int32_t));
+    sim->attempt = (int *)calloc(threads, sizeof(int));
+    sim->victim = (int *)calloc(threads, sizeof(int));
+    sim->first = (int *)malloc(threads * sizeof(int));
+    sim->waiting = (bool *)calloc(threads, sizeof(bool));
+    sim->exited = (bool *)calloc(threads, sizeof(bool));
+    sim->stacks = (struct Stack *)calloc(queue_count, sizeof(struct Stack));
+    sim->lock_free = (double *)calloc(queue_count, sizeof(double));
+    if (!sim->time || !sim->event || !sim->heap || !sim->node || !sim->attempt || !sim->victim || !sim->first ||
+        !sim->waiting || !sim->exited || !sim->stacks || !sim->lock_free) {
+        printf("Failed to allocate simulation - exiting\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < queue_count; ++i) {
+        sim->stacks[i].top = -1;
+    }
+
+    for (int i = 0; i < threads; ++i) {
+        sim->first[i] = -1;
+    }
+
+    // The root interval is queued after the initial evaluations
+    double prologue = tree->prologue * tree->unit_ns * 1e-9;
+    stack_push(&sim->stacks[0], 0);
+    sim->queued = 1;
+
+    for (int i = 0; i < threads; ++i) {
+        sim->time[i] = prologue;
+    }
+}
+
+void sim_destroy(struct Sim *sim)
+{
+    for (int i = 0; i < sim->queue_count; ++i) {
+        free(sim->stacks[i].entry);
+    }
+
+    free(sim->time);
+    free(sim->event);
+    free(sim->heap);
+    free(sim->node);
+    free(sim->attempt);
+    free(sim->victim);
+    free(sim->first);
+    free(sim->estimate);
+    free(sim->queue_cost);
+    free(sim->waiting);
+    free(sim->exited);
+    free(sim->stacks);
+    free(sim->lock_free);
+}
+
+// Solver 2 with a shared queue. Threads without work keep taking the queue
+// lock to poll it, and leave once it is empty while no thread is active.
+double simulate_shared(const struct Tree *tree, struct Latency latency, int threads)
+{
+    struct Sim sim;
+    sim_init(&sim, tree, latency, threads, 1);
+
+    for (int i = 0; i < threads; ++i) {
+        schedule(&sim, i, EV_LOCK, sim.time[i]);
+    }
+
+    while (sim.heap_size > 0) {
+        int t = next_event(&sim);
+        double now = sim.time[t];
+        int32_t node = sim.node[t];
+
+        switch (sim.event[t]) {
+        case EV_LOCK:
+            schedule(&sim, t, EV_TAKE, lock(&sim, 0, now, latency.lock));
+            break;
+
+        case EV_TAKE:
+            if (!stack_empty(&sim.stacks[0]))
+                start_node(&sim, t, stack_pop(&sim.stacks[0]), now);
+            else if (sim.active == 0)
+                leave(&sim, t, now);
+            else
+                schedule(&sim, t, EV_LOCK, now);
+            break;
+
+        case EV_DONE:
+            if (tree->right[node] >= 0) {
+                schedule(&sim, t, EV_PUSH, lock(&sim, 0, now, latency.lock));
+            } else {
+                sim.active--;
+                schedule(&sim, t, EV_LOCK, now);
+            }
+            break;
+
+        case EV_PUSH:
+            stack_push(&sim.stacks[0], node + 1);
+            stack_push(&sim.stacks[0], tree->right[node]);
+            sim.queued += 2;
+            sim.active--;
+            schedule(&sim, t, EV_LOCK, now);
+            break;
+
+        default:
+            assert(0);
+        }
+    }
+
+    double end = sim.end;
+    sim_destroy(&sim);
+    return end;
+}
+
+// Wake a sleeping thread, which then takes the queue lock
+static void wake_one(struct Sim *sim, double time)
+{
+    for (int i = 0; i < sim->threads; ++i) {
+        if (sim->waiting[i]) {
+            sim->waiting[i] = false;
+            schedule(sim, i, EV_LOCK, time + sim->latency.task);
+            return;
+        }
+    }
+}
+
+// Solver 1 with OpenMP tasks, modelled on a runtime with a single task pool
+// per team behind a lock. Creating a task costs latency.task outside the lock
+// plus a locked push, and wakes a sleeping thread. A thread waiting on its
+// children executes other tasks, so it never blocks while tasks are pending.
+double simulate_tasks(const struct Tree *tree, struct Latency latency, int threads)
+{
+    struct Sim sim;
+    sim_init(&sim, tree, latency, threads, 1);
+
+    // The thread executing the single construct runs the root directly, the
+    // others sleep at the barrier
+    stack_pop(&sim.stacks[0]);
+    start_node(&sim, 0, 0, sim.time[0]);
+    for (int i = 1; i < threads; ++i) {
+        sim.waiting[i] = true;
+    }
+
+    while (sim.heap_size > 0) {
+        int t = next_event(&sim);
+        double now = sim.time[t];
+        int32_t node = sim.node[t];
+
+        switch (sim.event[t]) {
+        case EV_LOCK:
+            schedule(&sim, t, EV_TAKE, lock(&sim, 0, now, latency.lock));
+            break;
+
+        case EV_TAKE:
+            if (!stack_empty(&sim.stacks[0])) {
+                start_node(&sim, t, stack_pop(&sim.stacks[0]), now);
+            } else if (sim.active == 0) {
+                // The last task is done, release everyone from the barrier
+                leave(&sim, t, now);
+                for (int i = 0; i < threads; ++i) {
+                    if (sim.waiting[i]) {
+                        sim.waiting[i] = false;
+                        leave(&sim, i, now + latency.task);
+                    }
+                }
+            } else {
+                sim.waiting[t] = true;
+            }
+            break;
+
+        case EV_DONE:
+            if (tree->right[node] >= 0) {
+                schedule(&sim, t, EV_PUSH, lock(&sim, 0, now + latency.task, latency.lock));
+            } else {
+                sim.active--;
+                schedule(&sim, t, EV_LOCK, now);
+            }
+            break;
+
+        case EV_PUSH:
+            stack_push(&sim.stacks[0], node + 1);
+            sim.queued++;
+            wake_one(&sim, now);
+            schedule(&sim, t, EV_PUSH2, lock(&sim, 0, now + latency.task, latency.lock));
+            break;
+
+        case EV_PUSH2:
+            stack_push(&sim.stacks[0], tree->right[node]);
+            sim.queued++;
+            wake_one(&sim, now);
+
+            // Taskwait, run queued tasks until the children are done
+            sim.active--;
+            schedule(&sim, t, EV_LOCK, now);
+            break;
+
+        default:
+            assert(0);
+        }
+    }
+
+    double end = sim.end;
+    sim_destroy(&sim);
+    return end;
+}
+
+// Estimate the cost of refining each node as the solvers' static cost model
+// does, its width times the cost of its evaluations
+static void estimate_costs(struct Sim *sim)
+{
+    const struct Tree *tree = sim->tree;
+
+    int *depth = (int *)malloc(sizeof(int) * tree->nodes);
+    sim->estimate = (double *)malloc(sizeof(double) * tree->nodes);
+    sim->queue_cost = (double *)calloc(sim->queue_count, sizeof(double));
+    if (!depth || !sim->estimate || !sim->queue_cost) {
+        printf("Failed to allocate cost estimates - exiting\n");
+        exit(1);
+    }
+
+    // Children follow their parent in preorder
+    depth[0] = 0;
+    for (long i = 0; i < tree->nodes; ++i) {
+        sim->estimate[i] = ldexp(tree->cost[i], -depth[i]);
+        if (tree->right[i] >= 0) {
+            depth[i + 1] = depth[i] + 1;
+            depth[tree->right[i]] = depth[i] + 1;
+        }
+    }
+
+    sim->queue_cost[0] = sim->estimate[0];
+    free(depth);
+}
+
+static void put(struct Sim *sim, int queue, int32_t node)
+{
+    stack_push(&sim->stacks[queue], node);
+    if (sim->queue_cost)
+        sim->queue_cost[queue] += sim->estimate[node];
+}
+
+// Take the top node of a queue, or its costliest when estimating costs
+static int32_t take(struct Sim *sim, int queue, bool costliest)
+{
+    struct Stack *stack = &sim->stacks[queue];
+
+    if (costliest) {
+        long best = stack->top;
+        for (long i = stack->top - 1; i >= 0; --i) {
+            if (sim->estimate[stack->entry[i]] > sim->estimate[stack->entry[best]])
+                best = i;
+        }
+
+        int32_t node = stack->entry[best];
+        memmove(&stack->entry[best], &stack->entry[best + 1], sizeof(int32_t) * (stack->top - best));
+        stack->entry[stack->top] = node;
+    }
+
+    int32_t node = stack_pop(stack);
+    if (sim->queue_cost)
+        sim->queue_cost[queue] -= sim->estimate[node];
+    return node;
+}
+
+// Queue with the largest estimated cost other than the thread's own, or -1
+static int costliest_queue(const struct Sim *sim, int t)
+{
+    int best = -1;
+    for (int i = 0; i < sim->queue_count; ++i) {
+        if (i != t && !stack_empty(&sim->stacks[i]) &&
+            (best < 0 || sim->queue_cost[i] > sim->queue_cost[best]))
+            best = i;
+    }
+    return best;
+}
+
+// Continue a steal round, or end it with the termination check of the solver
+static void probe(struct Sim *sim, int t, double now)
+{
+    int threads = sim->threads;
+
+    // Try the costliest queue before the round robin
+    if (sim->first[t] >= 0) {
+        int v = sim->first[t];
+        sim->first[t] = -1;
+
+        if (sim->lock_free[v] > now) {
+            schedule(sim, t, EV_PROBE, now + sim->latency.steal);
+        } else {
+            sim->victim[t] = v;
+            schedule(sim, t, EV_STOLEN, lock(sim, v, now, sim->latency.steal));
+        }
+        return;
+    }
+
+    if (sim->attempt[t] >= threads) {
+        if (stack_empty(&sim->stacks[t]) && sim->active == 0)
+            leave(sim, t, now);
+        else if (sim->queued == 0)
+            sim->waiting[t] = true;
+        else
+            schedule(sim, t, EV_LOCK, now);
+        return;
+    }
+
+    int v = (t + sim->attempt[t]) % threads;
+    sim->attempt[t]++;
+
+    if (sim->lock_free[v] > now) {
+        // omp_test_lock fails on a busy queue
+        schedule(sim, t, EV_PROBE, now + sim->latency.steal);
+    } else {
+        sim->victim[t] = v;
+        schedule(sim, t, EV_STOLEN, lock(sim, v, now, sim->latency.steal));
+    }
+}
+
+// Solver 2 with a queue per thread. Threads take from their own queue and
+// otherwise try every other queue in turn, skipping queues whose lock is
+// held. As in the solver, a thread leaves once its own queue is empty while
+// no thread is active, even if other queues still hold intervals. Polling
+// threads that found every queue empty sleep until an interval is queued and
+// then resume their round at that queue, which leaves out their cost to the
+// queue locks.
+//
+// With lpt set the solver's cost model is followed: children are queued with
+// the costlier one on top, and a steal round first tries the queue with the
+// largest estimated cost, taking the costliest node of the queue. The
+// costliest queue is probed again in the round robin, which costs at most one
+// extra probe.
+static double separate(const struct Tree *tree, struct Latency latency, int threads, bool lpt)
+{
+    struct Sim sim;
+    sim_init(&sim, tree, latency, threads, threads);
+    if (lpt)
+        estimate_costs(&sim);
+
+    for (int i = 0; i < threads; ++i) {
+        schedule(&sim, i, EV_LOCK, sim.time[i]);
+    }
+
+    while (sim.heap_size > 0) {
+        int t = next_event(&sim);
+        double now = sim.time[t];
+        int32_t node = sim.node[t];
+
+        switch (sim.event[t]) {
+        case EV_LOCK:
+            schedule(&sim, t, EV_TAKE, lock(&sim, t, now, latency.lock));
+            break;
+
+        case EV_TAKE:
+            if (!stack_empty(&sim.stacks[t])) {
+                start_node(&sim, t, take(&sim, t, false), now);
+            } else {
+                sim.attempt[t] = 1;
+                sim.first[t] = lpt ? costliest_queue(&sim, t) : -1;
+                probe(&sim, t, now);
+            }
+            break;
+
+        case EV_PROBE:
+            probe(&sim, t, now);
+            break;
+
+        case EV_STOLEN:
+            if (!stack_empty(&sim.stacks[sim.victim[t]]))
+                start_node(&sim, t, take(&sim, sim.victim[t], lpt), now);
+            else
+                probe(&sim, t, now);
+            break;
+
+        case EV_DONE:
+            if (tree->right[node] >= 0) {
+                schedule(&sim, t, EV_PUSH, lock(&sim, t, now, latency.lock));
+            } else {
+                sim.active--;
+
+                // Sleeping threads notice the end on their next round
+                if (sim.active == 0) {
+                    for (int i = 0; i < threads; ++i) {
+                        if (sim.waiting[i]) {
+                            sim.waiting[i] = false;
+                            sim.attempt[i] = threads;
+                            schedule(&sim, i, EV_PROBE, now + latency.steal);
+                        }
+                    }
+                }
+
+                schedule(&sim, t, EV_LOCK, now);
+            }
+            break;
+
+        case EV_PUSH:
+            if (lpt && sim.estimate[node + 1] > sim.estimate[tree->right[node]]) {
+                put(&sim, t, tree->right[node]);
+                put(&sim, t, node + 1);
+            } else {
+                put(&sim, t, node + 1);
+                put(&sim, t, tree->right[node]);
+            }
+            sim.queued += 2;
+            sim.active--;
+
+            for (int i = 0; i < threads; ++i) {
+                if (sim.waiting[i]) {
+                    int distance = (t - i + threads) % threads;
+                    sim.waiting[i] = false;
+                    sim.attempt[i] = distance;
+                    schedule(&sim, i, EV_PROBE, now + distance * latency.steal);
+                }
+            }
+
+            schedule(&sim, t, EV_LOCK, now);
+            break;
+
+        default:
+            assert(0);
+        }
+    }
+
+    double end = sim.end;
+    sim_destroy(&sim);
+    return end;
+}
+
+// Random queue for the MultiQueue
+static int random_queue(struct Sim *sim)
+{
+    sim->random ^= sim->random >> 12;
+    sim->random ^= sim->random << 25;
+    sim->random ^= sim->random >> 27;
+
+    return (int)(((sim->random * 0x2545f4914f6cdd1dULL) >> 32) % sim->queue_count);
+}
+
+// Solver 2 with a MultiQueue of two sub-queues per thread. A thread looks at
+// two random sub-queues without their locks and takes from the fuller one,
+// and after four misses tries every sub-queue in turn. Each child is queued
+// on its own random sub-queue. No queue is local, so every locked operation
+// costs the steal latency. The sub-queues are modelled as stacks ordered on
+// depth, which is what the solver's default priority gives. Threads leave
+// once no interval is queued or evaluated.
+double simulate_multi(const struct Tree *tree, struct Latency latency, int threads)
+{
+    struct Sim sim;
+    sim_init(&sim, tree, latency, threads, 2 * threads);
+    sim.random = 0x9e3779b97f4a7c15ULL;
+
+    for (int i = 0; i < threads; ++i) {
+        schedule(&sim, i, EV_LOCK, sim.time[i]);
+    }
+
+    while (sim.heap_size > 0) {
+        int t = next_event(&sim);
+        double now = sim.time[t];
+        int32_t node = sim.node[t];
+
+        switch (sim.event[t]) {
+        case EV_LOCK:
+            sim.attempt[t] = 0;
+            // fall through
+        case EV_PROBE: {
+            int q = -1;
+
+            if (sim.attempt[t] < 4) {
+                int a = random_queue(&sim), b = random_queue(&sim);
+                q = (sim.stacks[b].top > sim.stacks[a].top) ? b : a;
+                sim.attempt[t]++;
+            } else {
+                for (int i = 0; i < sim.queue_count; ++i) {
+                    if (!stack_empty(&sim.stacks[i])) {
+                        q = i;
+                        break;
+                    }
+                }
+            }
+
+            if (q >= 0 && !stack_empty(&sim.stacks[q])) {
+                sim.victim[t] = q;
+                schedule(&sim, t, EV_STOLEN, lock(&sim, q, now + latency.steal, latency.steal));
+            } else if (sim.queued == 0 && sim.active == 0) {
+                leave(&sim, t, now);
+            } else {
+                schedule(&sim, t, (sim.attempt[t] < 4) ? EV_PROBE : EV_LOCK, now + latency.steal);
+            }
+            break;
+        }
+
+        case EV_STOLEN:
+            if (!stack_empty(&sim.stacks[sim.victim[t]]))
+                start_node(&sim, t, stack_pop(&sim.stacks[sim.victim[t]]), now);
+            else
+                schedule(&sim, t, EV_PROBE, now);
+            break;
+
+        case EV_DONE:
+            if (tree->right[node] >= 0) {
+                sim.victim[t] = random_queue(&sim);
+                schedule(&sim, t, EV_PUSH, lock(&sim, sim.victim[t], now, latency.steal));
+            } else {
+                sim.active--;
+                schedule(&sim, t, EV_LOCK, now);
+            }
+            break;
+
+        case EV_PUSH:
+            stack_push(&sim.stacks[sim.victim[t]], node + 1);
+            sim.queued++;
+            sim.victim[t] = random_queue(&sim);
+            schedule(&sim, t, EV_PUSH2, lock(&sim, sim.victim[t], now, latency.steal));
+            break;
+
+        case EV_PUSH2:
+            stack_push(&sim.stacks[sim.victim[t]], tree->right[node]);
+            sim.queued++;
+            sim.active--;
+            schedule(&sim, t, EV_LOCK, now);
+            break;
+
+        default:
+            assert(0);
+        }
+    }
+
+    double end = sim.end;
+    sim_destroy(&sim);
+    return end;
+}
+
+// Solver 2 with a queue per thread and work pushing. A thread that finds its
+// queue empty advertises itself and polls its mailbox. A thread that takes
+// an interval while others are advertised and its queue holds more pushes
+// the oldest half, up to 4 intervals, to the first of them after itself,
+// which costs it a remote operation. Queues are only ever locked by their
+// owner. The mailbox of thread i is queue threads + i.
+double simulate_push(const struct Tree *tree, struct Latency latency, int threads)
+{
+    struct Sim sim;
+    sim_init(&sim, tree, latency, threads, 2 * threads);
+    int advertised = 0;
+
+    for (int i = 0; i < threads; ++i) {
+        schedule(&sim, i, EV_LOCK, sim.time[i]);
+    }
+
+    while (sim.heap_size > 0) {
+        int t = next_event(&sim);
+        double now = sim.time[t];
+        int32_t node = sim.node[t];
+        struct Stack *own = &sim.stacks[t];
+
+        switch (sim.event[t]) {
+        case EV_LOCK:
+            schedule(&sim, t, EV_TAKE, lock(&sim, t, now, latency.lock));
+            break;
+
+        case EV_TAKE: {
+            struct Stack *mail = &sim.stacks[threads + t];
+            while (!stack_empty(mail)) {
+                stack_push(own, mail->entry[0]);
+                memmove(&mail->entry[0], &mail->entry[1], sizeof(int32_t) * mail->top);
+                mail->top--;
+            }
+
+            if (stack_empty(own)) {
+                sim.waiting[t] = true;
+                advertised++;
+                schedule(&sim, t, EV_PROBE, now + latency.lock);
+                break;
+            }
+
+            int32_t next = stack_pop(own);
+            double start = now;
+
+            if (advertised > 0 && !stack_empty(own)) {
+                for (int i = 1; i < threads; ++i) {
+                    int r = (t + i) % threads;
+                    if (!sim.waiting[r])
+                        continue;
+
+                    long n = (own->top + 2) / 2;
+                    if (n > 4)
+                        n = 4;
+                    for (long k = 0; k < n; ++k) {
+                        stack_push(&sim.stacks[threads + r], own->entry[k]);
+                    }
+                    memmove(&own->entry[0], &own->entry[n], sizeof(int32_t) * (own->top + 1 - n));
+                    own->top -= n;
+
+                    sim.waiting[r] = false;
+                    advertised--;
+                    start += latency.steal;
+                    break;
+                }
+            }
+
+            start_node(&sim, t, next, start);
+            break;
+        }
+
+        case EV_PROBE:
+            if (!stack_empty(&sim.stacks[threads + t]))
+                schedule(&sim, t, EV_LOCK, now);
+            else if (sim.queued == 0 && sim.active == 0)
+                leave(&sim, t, now);
+            else
+                schedule(&sim, t, EV_PROBE, now + latency.lock);
+            break;
+
+        case EV_DONE:
+            if (tree->right[node] >= 0) {
+                schedule(&sim, t, EV_PUSH, lock(&sim, t, now, latency.lock));
+            } else {
+                sim.active--;
+                schedule(&sim, t, EV_LOCK, now);
+            }
+            break;
+
+        case EV_PUSH:
+            stack_push(own, node + 1);
+            stack_push(own, tree->right[node]);
+            sim.queued += 2;
+            sim.active--;
+            schedule(&sim, t, EV_LOCK, now);
+            break;
+
+        default:
+            assert(0);
+        }
+    }
+
+    double end = sim.end;
+    sim_destroy(&sim);
+    return end;
+}
+
+double simulate_separate(const struct Tree *tree, struct Latency latency, int threads)
+{
+    return separate(tree, latency, threads, false);
+}
+
+double simulate_separate_lpt(const struct Tree *tree, struct Latency latency, int threads)
+{
+    return separate(tree, latency, threads, true);
+}
+
+struct Model {
+    const char *name;
+    double (*simulate)(const struct Tree *, struct Latency, int);
+};
+
+static const struct Model models[] = {
+    { "solver1",          simulate_tasks },
+    { "solver2_shared",   simulate_shared },
+    { "solver2_separate", simulate_separate },
+    { "separate_lpt",     simulate_separate_lpt },
+    { "solver2_multi",    simulate_multi },
+    { "separate_push",    simulate_push },
+};
+
+#define MODELS (int)(sizeof(models) / sizeof(models[0]))
+
+int main(int argc, char **argv)
+{
+    // Record a trace: simulate --record file [left right [tol]]
+    if (argc > 2 && strcmp(argv[1], "--record") == 0) {
+        double left  = (argc > 4) ? atof(argv[3]) : 0.0;
+        double right = (argc > 4) ? atof(argv[4]) : 10.0;
+        double tol   = (argc > 5) ? atof(argv[5]) : 1e-06;
+
+        write_trace(argv[2], left, right, tol);
+        return 0;
+    }
+
+    // Replay a trace: simulate file [lock ns [steal ns [task ns [cores...]]]]
+    if (argc < 2) {
+        printf("Usage: simulate --record file [left right [tol]]\n");
+        printf("       simulate file [lock ns [steal ns [task ns [cores...]]]]\n");
+        exit(1);
+    }
+
+    struct Tree tree;
+    read_trace(argv[1], &tree);
+
+    struct Latency latency;
+    latency.lock  = ((argc > 2) ? atof(argv[2]) : 50.0) * 1e-9;
+    latency.steal = ((argc > 3) ? atof(argv[3]) : 200.0) * 1e-9;
+    latency.task  = ((argc > 4) ? atof(argv[4]) : 500.0) * 1e-9;
+
+    if (latency.lock <= 0.0 || latency.steal <= 0.0) {
+        printf("Lock and steal latencies must be positive - exiting\n");
+        exit(1);
+    }
+
+    int core_count = (argc > 5) ? argc - 5 : (int)(sizeof(default_cores) / sizeof(default_cores[0]));
+    int *cores = (int *)malloc(sizeof(int) * core_count);
+    if (!cores) {
+        printf("Failed to allocate core counts - exiting\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < core_count; ++i) {
+        cores[i] = (argc > 5) ? atoi(argv[5 + i]) : default_cores[i];
+        if (cores[i] < 1) {
+            printf("Invalid core count %s - exiting\n", argv[5 + i]);
+            exit(1);
+        }
+    }
+
+    double units = tree.prologue;
+    for (long i = 0; i < tree.nodes; ++i) {
+        units += tree.cost[i];
+    }
+    double serial = units * tree.unit_ns * 1e-9;
+
+    printf("Nodes = %ld\n", tree.nodes);
+    printf("Cost unit(ns) = %f\n", tree.unit_ns);
+    printf("Serial time(s) = %f\n", serial);
+    printf("Lock(ns) = %.1f\n", latency.lock * 1e9);
+    printf("Steal(ns) = %.1f\n", latency.steal * 1e9);
+    printf("Task(ns) = %.1f\n", latency.task * 1e9);
+
+    // Predicted time and speed-up of every model at every core count
+    printf("\n%6s", "Cores");
+    for (int m = 0; m < MODELS; ++m) {
+        printf(" %28s", models[m].name);
+    }
+    printf("\n");
+
+    double *speedup = (double *)malloc(sizeof(double) * MODELS);
+    if (!speedup) {
+        printf("Failed to allocate results - exiting\n");
+        exit(1);
+    }
+
+    for (int c = 0; c < core_count; ++c) {
+        printf("%6d", cores[c]);
+        for (int m = 0; m < MODELS; ++m) {
+            double time = models[m].simulate(&tree, latency, cores[c]);
+            speedup[m] = serial / time;
+            printf("   %10.4fs (speed-up %6.1f)", time, speedup[m]);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    // Rank the designs at the largest core count simulated
+    printf("\nRanking at %d cores:\n", cores[core_count - 1]);
+    bool ranked[MODELS] = { false };
+    for (int r = 0; r < MODELS; ++r) {
+        int best = -1;
+        for (int m = 0; m < MODELS; ++m) {
+            if (!ranked[m] && (best < 0 || speedup[m] > speedup[best]))
+                best = m;
+        }
+        ranked[best] = true;
+        printf("%d. %s speed-up = %.1f\n", r + 1, models[best].name, speedup[best]);
+    }
+
+    free(speedup);
+    free(cores);
+    free(tree.cost);
+    free(tree.right);
+}
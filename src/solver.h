@@ -0,0 +1,42 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include "function.h"
+#include "footprint.h"
+#include "counters.h"
+#include "idle.h"
+
+// Statistics gathered by the solvers during a run. When footprint is set the
+// queue solvers initialise it and record their memory use in it, and it must
+// then be released with footprint_destroy. When counters is set and enabled
+// each solver thread adds its cache misses to it. When idle is set the queue
+// solvers keep the idle state of the run in it for idle_report, and it must
+// then be released with idle_destroy.
+struct SolverStats {
+    long evaluations; // number of function evaluations
+    int threads;      // threads in the team that ran the integration
+    long speculated;  // evaluations made before knowing the interval splits
+    long wasted;      // speculative evaluations of intervals that did not split
+    long pushes;      // batches of intervals pushed to idle threads
+    long pushed;      // intervals in those batches
+    long passes;      // flat combining passes of the shared queue solver
+    long combined;    // requests served by those passes
+    long eliminated;  // intervals handed from a put to a take without the queue
+    struct Footprint *footprint;
+    struct Counters *counters;
+    struct Idle *idle;
+};
+
+// Library entry point of the queue solvers. Integrates the integrand over
+// [left, right] to the given tolerance using all threads of a new parallel
+// region and fills in stats unless it is NULL. Compile a solver with
+// -DSOLVER_LIBRARY to leave out main.
+double integrate(const struct Integrand *integrand, double left, double right, double tol,
+                 struct SolverStats *stats);
+
+// Whether SOLVER_BALANCE selects pushing work to idle threads rather than
+// stealing in the separate queue solver. Returns false, leaving stealing on,
+// if it names neither push nor steal.
+bool balance_parse(bool *pushing);
+
+#endif
@@ -1,9 +1,16 @@
 #include <math.h>
 #include <omp.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "function.h"
+#include "refine.h"
+#include "solver.h"
+#include "energy.h"
+#include "tasks.h"
+#include "expr.h"
 
 struct Interval {
     double left;    // left boundary
@@ -14,6 +21,27 @@ struct Interval {
     double f_right; // function value at right boundary
 };
 
+// Number of function evaluations made by each thread. Tasks may run on any
+// thread so each one counts into the copy of the thread executing it.
+long evaluations = 0;
+#pragma omp threadprivate(evaluations)
+
+// Integrand and the relative error of its values, func1 unless SOLVER_EXPR
+// gives an expression
+double (*integrand)(double) = func1;
+double noise = FUNC1_NOISE;
+
+struct Expr expr;
+struct Integrand compiled;
+
+// Evaluate the expression in SOLVER_EXPR at a single point
+double expression(double x)
+{
+    double fx;
+    compiled.eval(&x, &fx, 1, compiled.data);
+    return fx;
+}
+
 double simpson(double (*func)(double), struct Interval interval)
 {
     assert(func);
@@ -26,12 +54,15 @@ double simpson(double (*func)(double), struct Interval interval)
     double e  = (c + interval.right) / 2.0;
     double fd = func(d);
     double fe = func(e);
+    evaluations += 2;
 
     // Compute integral estimates using 3 and 5 points respectively
     double q1 = h / 6.0 * (interval.f_left + 4.0 * interval.f_mid + interval.f_right);
     double q2 = h / 12.0 * (interval.f_left + 4.0 * fd + 2.0 * interval.f_mid + 4.0 * fe + interval.f_right);
 
-    if ((fabs(q2 - q1) < interval.tol) || ((interval.right - interval.left) < 1.0e-12)) {
+    if ((fabs(q2 - q1) < interval.tol) ||
+        unresolvable(interval.left, interval.right, interval.f_left, fd, interval.f_mid, fe,
+                     interval.f_right, q1, q2, noise)) {
         // Tolerance is met, return
         return q2 + (q2 - q1) / 15.0;
     } else {
@@ -72,32 +103,224 @@ double simpson(double (*func)(double), struct Interval interval)
     }
 }
 
+// Arguments and result of a recursive call run as a task of the runtime in
+// tasks.c, kept on the stack of the spawning call
+struct Call {
+    double (*func)(double);
+    struct Interval interval;
+    double quad;
+};
+
+double simpson_spawn(double (*func)(double), struct Interval interval);
+
+void simpson_task(void *arg)
+{
+    struct Call *call = (struct Call *)arg;
+    call->quad = simpson_spawn(call->func, call->interval);
+}
+
+// The same recursion on the spawn/sync runtime. The first half is spawned
+// and the second evaluated by the calling thread, which then picks the first
+// half back up unless another thread stole it.
+double simpson_spawn(double (*func)(double), struct Interval interval)
+{
+    assert(func);
+
+    // Already have function evaluations at each end of the interval and in the middle
+    // Now get function values at one-quarter and three-quarter points
+    double h  = interval.right - interval.left;
+    double c  = (interval.left + interval.right) / 2.0;
+    double d  = (interval.left + c) / 2.0;
+    double e  = (c + interval.right) / 2.0;
+    double fd = func(d);
+    double fe = func(e);
+    evaluations += 2;
+
+    // Compute integral estimates using 3 and 5 points respectively
+    double q1 = h / 6.0 * (interval.f_left + 4.0 * interval.f_mid + interval.f_right);
+    double q2 = h / 12.0 * (interval.f_left + 4.0 * fd + 2.0 * interval.f_mid + 4.0 * fe + interval.f_right);
+
+    if ((fabs(q2 - q1) < interval.tol) ||
+        unresolvable(interval.left, interval.right, interval.f_left, fd, interval.f_mid, fe,
+                     interval.f_right, q1, q2, noise)) {
+        // Tolerance is met, return
+        return q2 + (q2 - q1) / 15.0;
+    } else {
+        // Tolerance is not met, split interval in two and make recursive calls
+        struct Call first;
+        struct Interval i2;
+        struct Task task;
+
+        first.func             = func;
+        first.interval.left    = interval.left;
+        first.interval.right   = c;
+        first.interval.tol     = interval.tol;
+        first.interval.f_left  = interval.f_left;
+        first.interval.f_mid   = fd;
+        first.interval.f_right = interval.f_mid;
+
+        i2.left    = c;
+        i2.right   = interval.right;
+        i2.tol     = interval.tol;
+        i2.f_left  = interval.f_mid;
+        i2.f_mid   = fe;
+        i2.f_right = interval.f_right;
+
+        task_spawn(&task, simpson_task, &first);
+        double quad2 = simpson_spawn(func, i2);
+        task_sync(&task);
+
+        return first.quad + quad2;
+    }
+}
+
+// Root task and per-thread epilogue of a run on the spawn/sync runtime
+struct Root {
+    struct Interval whole;
+    double quad;
+    long total_evaluations;
+};
+
+void root_task(void *arg)
+{
+    struct Root *root = (struct Root *)arg;
+    root->quad = simpson_spawn(integrand, root->whole);
+}
+
+void root_leave(void *arg)
+{
+    struct Root *root = (struct Root *)arg;
+
+#pragma omp atomic
+    root->total_evaluations += evaluations;
+}
+
+// Integrand of a library call, which evaluates batches of points
+const struct Integrand *called;
+
+double called_eval(double x)
+{
+    double fx;
+    called->eval(&x, &fx, 1, called->data);
+    return fx;
+}
+
+double integrate(const struct Integrand *integrand, double left, double right, double tol,
+                 struct SolverStats *stats)
+{
+    assert(integrand);
+
+    called = integrand;
+    noise = integrand->noise;
+
+    // Split the domain at the breakpoints as the queue solvers do, and start
+    // the recursion on each piece in a task of its own
+    struct Piece *pieces;
+    int count = integrand_pieces(integrand, left, right, &pieces);
+
+    double quad = 0.0;
+    long total_evaluations = 3 * count;
+    int team = 0;
+
+#pragma omp parallel default(none) shared(quad, pieces, count, tol, total_evaluations, team)
+    {
+        // The counts of earlier calls are still in the threadprivate copies
+        evaluations = 0;
+
+#pragma omp single
+        {
+            team = omp_get_num_threads();
+
+            for (int i = 0; i < count; ++i) {
+#pragma omp task default(none) shared(quad, pieces, tol) firstprivate(i)
+                {
+                    struct Interval piece = { pieces[i].left, pieces[i].right, tol,
+                                              pieces[i].f_left, pieces[i].f_mid, pieces[i].f_right };
+                    double part = simpson(called_eval, piece);
+
+#pragma omp atomic
+                    quad += part;
+                }
+            }
+        }
+
+#pragma omp atomic
+        total_evaluations += evaluations;
+    }
+
+    free(pieces);
+
+    if (stats) {
+        stats->evaluations = total_evaluations;
+        stats->threads = team;
+    }
+
+    return quad;
+}
+
+#ifndef SOLVER_LIBRARY
 int main(void)
 {
     struct Interval whole;
     double quad = 0.0;
+    long total_evaluations = 3;
+    struct Energy energy;
+
+    if (expr_from_env(&expr, &compiled)) {
+        integrand = expression;
+        noise = compiled.noise;
+    }
 
     double start = omp_get_wtime();
+    energy_start(&energy);
 
     // Create initial interval
     whole.left    = 0.0;
     whole.right   = 10.0;
     whole.tol     = 1e-06;
-    whole.f_left  = func1(whole.left);
-    whole.f_right = func1(whole.right);
-    whole.f_mid   = func1((whole.left + whole.right) / 2.0);
+    whole.f_left  = integrand(whole.left);
+    whole.f_right = integrand(whole.right);
+    whole.f_mid   = integrand((whole.left + whole.right) / 2.0);
 
     printf("Threads: %d\n", omp_get_max_threads());
+    printf("Kernel variant: %s\n", kernel_variant());
 
-    // Call recursive quadrature routine
-#pragma omp parallel default(none) shared(quad, whole)
-    {
-#pragma omp single
+    // OpenMP tasks, or with SOLVER_TASKS=spawn the runtime in tasks.c
+    const char *runtime = getenv("SOLVER_TASKS");
+    if (runtime && strcmp(runtime, "spawn") == 0) {
+        struct Root root = { whole, 0.0, 0 };
+        struct TaskStats stats;
+
+        tasks_run(root_task, root_leave, &root, &stats);
+        quad = root.quad;
+        total_evaluations += root.total_evaluations;
+
+        printf("Spawned tasks = %ld\n", stats.spawned);
+        printf("Stolen tasks = %ld\n", stats.stolen);
+        printf("Steal attempts = %ld\n", stats.steals);
+    } else if (runtime && strcmp(runtime, "omp") != 0) {
+        printf("Unknown SOLVER_TASKS %s - exiting\n", runtime);
+        exit(1);
+    } else {
+        // Call recursive quadrature routine
+#pragma omp parallel default(none) shared(quad, whole, total_evaluations, integrand)
         {
-            quad = simpson(func1, whole);
+#pragma omp single
+            {
+                quad = simpson(integrand, whole);
+            }
+
+            // The single construct ends with a barrier so all tasks are done
+#pragma omp atomic
+            total_evaluations += evaluations;
         }
-    }   
+    }
+
+    energy_stop(&energy);
+    double end = omp_get_wtime();
 
     printf("Result = %e\n", quad);
-    printf("Time(s) = %f\n", omp_get_wtime() - start);
+    printf("Time(s) = %f\n", end - start);
+    energy_report(&energy, 1, total_evaluations, stdout);
 }
+#endif
@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <math.h>
+#include <omp.h>
+
+#include "async.h"
+#include "function.h"
+#include "refine.h"
+#include "energy.h"
+
+#define MAXQUEUE 10000
+
+// Intervals each thread keeps in flight unless overridden by SOLVER_INFLIGHT
+#define INFLIGHT 16
+
+// Stand-in server settings unless overridden by SOLVER_LATENCY in
+// microseconds and SOLVER_SERVER_SLOTS
+#define LATENCY 100.0
+#define SERVER_SLOTS 64
+
+struct Interval {
+    double left;    // left boundary
+    double right;   // right boundary
+    double tol;     // tolerance
+    double f_left;  // function value at left boundary
+    double f_mid;   // function value at midpoint
+    double f_right; // function value at right boundary
+};
+
+struct Queue {
+    struct Interval entry[MAXQUEUE]; // array of queue entries
+    int16_t top;                     // index of last entry
+    omp_lock_t lock;                 // Queue lock
+};
+
+// Interval waiting for the values at its quarter points. Its evaluations are
+// tagged with twice its slot number, plus one for the right quarter point.
+struct Slot {
+    struct Interval interval;
+    double fd, fe;                   // values at the quarter points
+    int missing;                     // evaluations still outstanding
+};
+
+// add an interval to the queue
+void enqueue(struct Interval *interval, struct Queue *queue_p)
+{
+    if (queue_p->top == MAXQUEUE - 1) {
+        printf("Maximum queue size exceeded - exiting\n");
+        exit(1);
+    }
+
+    queue_p->top++;
+
+    queue_p->entry[queue_p->top] = *interval;
+}
+
+// extract last interval from queue
+void dequeue(struct Queue *queue_p, struct Interval *interval)
+{
+    if (queue_p->top == -1) {
+        printf("Attempt to extract from empty queue - exiting\n");
+        exit(1);
+    }
+
+    *interval = queue_p->entry[queue_p->top];
+
+    queue_p->top--;
+}
+
+// initialise queue
+void initialize(struct Queue *queue_p)
+{
+    queue_p->top = -1;
+    omp_init_lock(&queue_p->lock);
+}
+
+// terminate queue
+void terminate(struct Queue *queue_p)
+{
+    omp_destroy_lock(&queue_p->lock);
+    queue_p->top = -1;
+}
+
+// return whether queue is empty
+int isempty(struct Queue *queue_p)
+{
+    int result = (queue_p->top == -1);
+
+    return result;
+}
+
+// take an interval from the own queue, or else from another thread's queue
+// in a round robin fashion
+bool take(struct Queue *queues, int queues_size, int thread_id, struct Interval *interval)
+{
+    bool taken = false;
+
+    omp_set_lock(&queues[thread_id].lock);
+    if (!isempty(&queues[thread_id])) {
+        dequeue(&queues[thread_id], interval);
+        taken = true;
+    }
+    omp_unset_lock(&queues[thread_id].lock);
+
+    for (int attempt = 1; attempt < queues_size && !taken; ++attempt) {
+        struct Queue *other_queue = &queues[(thread_id + attempt) % queues_size];
+
+        if (omp_test_lock(&other_queue->lock)) {
+            if (!isempty(other_queue)) {
+                dequeue(other_queue, interval);
+                taken = true;
+            }
+            omp_unset_lock(&other_queue->lock);
+        }
+    }
+
+    return taken;
+}
+
+// Integrate with every thread keeping up to inflight intervals waiting for
+// their evaluations. A thread fills its free slots from the queues, submitting
+// both quarter points of each interval, then takes whatever values have
+// arrived and finishes the intervals that have both, splitting them or adding
+// them to the total. It only blocks in poll when it can not start anything
+// else. pending counts the intervals that are queued or in a slot, so the run
+// is over once it drops to 0.
+double simpson(const struct AsyncIntegrand *integrand, struct Queue *queues, int queues_size, int inflight,
+               long *evaluations)
+{
+    assert(integrand && queues && inflight > 0);
+
+    double quad = 0.0;
+    long pending = 1;
+
+    #pragma omp parallel default(none) shared(integrand, queues, queues_size, inflight, pending, quad, evaluations)
+    {
+        int thread_id = omp_get_thread_num();
+        struct Queue *local_queue = &queues[thread_id];
+
+        struct Slot *slots = (struct Slot *)malloc(sizeof(struct Slot) * inflight);
+        int *free_slots = (int *)malloc(sizeof(int) * inflight);
+        struct Completion *done = (struct Completion *)malloc(sizeof(struct Completion) * 2 * inflight);
+        if (!slots || !free_slots || !done) {
+            printf("Failed to allocate slots - exiting\n");
+            exit(1);
+        }
+
+        int free_count = inflight;
+        for (int s = 0; s < inflight; ++s) {
+            free_slots[s] = inflight - 1 - s;
+        }
+
+        double local_quad = 0.0;
+        long local_evaluations = 0;
+
+        while (1) {
+            struct Interval interval;
+
+            // Start as many intervals as there are free slots and work
+            while (free_count > 0 && take(queues, queues_size, thread_id, &interval)) {
+                int s = free_slots[--free_count];
+                double c = (interval.left + interval.right) / 2.0;
+
+                slots[s].interval = interval;
+                slots[s].missing = 2;
+                integrand->submit(thread_id, (interval.left + c) / 2.0, 2L * s, integrand->data);
+                integrand->submit(thread_id, (c + interval.right) / 2.0, 2L * s + 1, integrand->data);
+                local_evaluations += 2;
+            }
+
+            if (free_count == inflight) {
+                long left;
+                #pragma omp atomic read
+                left = pending;
+
+                if (left == 0)
+                    break;
+
+                // Other threads still hold intervals that may split
+                continue;
+            }
+
+            int n = integrand->poll(thread_id, done, 2 * inflight, true, integrand->data);
+
+            for (int k = 0; k < n; ++k) {
+                int s = (int)(done[k].tag / 2);
+                struct Slot *slot = &slots[s];
+
+                if (done[k].tag % 2 == 0)
+                    slot->fd = done[k].fx;
+                else
+                    slot->fe = done[k].fx;
+
+                if (--slot->missing > 0)
+                    continue;
+
+                struct Interval *iv = &slot->interval;
+                double h = iv->right - iv->left;
+                double c = (iv->left + iv->right) / 2.0;
+
+                double q1 = h / 6.0  * (iv->f_left + 4.0 * iv->f_mid + iv->f_right);
+                double q2 = h / 12.0 * (iv->f_left + 4.0 * slot->fd + 2.0 * iv->f_mid + 4.0 * slot->fe + iv->f_right);
+
+                if ((fabs(q2 - q1) < iv->tol) ||
+                    unresolvable(iv->left, iv->right, iv->f_left, slot->fd, iv->f_mid, slot->fe, iv->f_right,
+                                 q1, q2, integrand->noise)) {
+                    // Tolerance is met, add to total
+                    local_quad += q2 + (q2 - q1) / 15.0;
+
+                    #pragma omp atomic
+                    pending--;
+                } else {
+                    // Tolerance is not met, split interval in two and add
+                    // both halves to the queue
+                    struct Interval i1 = { iv->left, c, iv->tol, iv->f_left, slot->fd, iv->f_mid };
+                    struct Interval i2 = { c, iv->right, iv->tol, iv->f_mid, slot->fe, iv->f_right };
+
+                    #pragma omp atomic
+                    pending++;
+
+                    omp_set_lock(&local_queue->lock);
+                    {
+                        enqueue(&i1, local_queue);
+                        enqueue(&i2, local_queue);
+                    }
+                    omp_unset_lock(&local_queue->lock);
+                }
+
+                free_slots[free_count++] = s;
+            }
+        } // while
+
+        #pragma omp atomic
+        quad += local_quad;
+
+        #pragma omp atomic
+        *evaluations += local_evaluations;
+
+        free(done);
+        free(free_slots);
+        free(slots);
+    } // parallel
+
+    return quad;
+}
+
+// Evaluate the integrand at x on the first worker and wait for it
+double evaluate(const struct AsyncIntegrand *integrand, double x)
+{
+    struct Completion done;
+
+    integrand->submit(0, x, 0, integrand->data);
+    integrand->poll(0, &done, 1, true, integrand->data);
+
+    return done.fx;
+}
+
+int main(int argc, char **argv)
+{
+    int thread_count = omp_get_max_threads();
+
+    const char *setting = getenv("SOLVER_INFLIGHT");
+    int inflight = (setting && atoi(setting) > 0) ? atoi(setting) : INFLIGHT;
+
+    setting = getenv("SOLVER_LATENCY");
+    double latency = (setting && atof(setting) >= 0.0) ? atof(setting) : LATENCY;
+
+    setting = getenv("SOLVER_SERVER_SLOTS");
+    int server_slots = (setting && atoi(setting) > 0) ? atoi(setting) : SERVER_SLOTS;
+
+    // The tolerance is given by: solver2_async [tolerance]
+    double tol = (argc > 1) ? atof(argv[1]) : 1e-06;
+    if (tol <= 0.0) {
+        printf("Tolerance must be positive - exiting\n");
+        exit(1);
+    }
+
+    printf("Threads: %d\n", thread_count);
+    printf("Kernel variant: %s\n", kernel_variant());
+    printf("In flight: %d\n", inflight);
+    printf("Latency(us): %g\n", latency);
+    printf("Server slots: %d\n", server_slots);
+    printf("Tolerance: %g\n", tol);
+
+    struct AsyncServer server;
+    async_server_init(&server, thread_count, 2 * inflight, latency * 1e-6, server_slots);
+    struct AsyncIntegrand integrand = async_server_integrand(&server);
+
+    struct Queue *queues = (struct Queue *)malloc(sizeof(struct Queue) * thread_count);
+    if (!queues) {
+        printf("Failed to allocate queues - exiting\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < thread_count; ++i) {
+        initialize(&queues[i]);
+    }
+
+    struct Energy energy;
+    long evaluations = 3;
+
+    double start = omp_get_wtime();
+    energy_start(&energy);
+
+    // Add initial interval to the queue
+    struct Interval whole;
+    whole.left    = 0.0;
+    whole.right   = 10.0;
+    whole.tol     = tol;
+    whole.f_left  = evaluate(&integrand, whole.left);
+    whole.f_right = evaluate(&integrand, whole.right);
+    whole.f_mid   = evaluate(&integrand, (whole.left + whole.right) / 2.0);
+
+    enqueue(&whole, &queues[0]);
+
+    double quad = simpson(&integrand, queues, thread_count, inflight, &evaluations);
+
+    energy_stop(&energy);
+    double end = omp_get_wtime();
+
+    printf("Result = %e\n", quad);
+    printf("Time(s) = %f\n", end - start);
+    energy_report(&energy, 1, evaluations, stdout);
+    printf("Server requests: %ld\n", server.requests);
+    printf("Blocked time(s) = %f\n", async_server_blocked(&server));
+
+    for (int i = 0; i < thread_count; ++i) {
+        terminate(&queues[i]);
+    }
+
+    free(queues);
+    async_server_destroy(&server);
+}
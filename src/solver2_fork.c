@@ -0,0 +1,505 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <omp.h>
+
+#include "function.h"
+#include "refine.h"
+#include "energy.h"
+
+#define MAXQUEUE 10000
+
+// Maximum number of worker processes
+#define MAXPROCS 64
+
+// Intervals per worker to refine to before forking
+#define SEEDS 4
+
+struct Interval {
+    double left;    // left boundary
+    double right;   // right boundary
+    double tol;     // tolerance
+    double f_left;  // function value at left boundary
+    double f_mid;   // function value at midpoint
+    double f_right; // function value at right boundary
+};
+
+// Queue of a worker process in shared memory. The lock is process-shared so
+// that threads of other workers can steal from it.
+struct Queue {
+    struct Interval entry[MAXQUEUE]; // array of queue entries
+    int16_t top;                     // index of last entry
+
+    pthread_mutex_t lock;            // Queue lock
+};
+
+// Everything the workers share, mapped before forking. OpenMP atomics only
+// cover the threads of one process, so active_threads is accessed with the
+// __atomic builtins, which also hold across processes.
+struct Shared {
+    int active_threads;              // threads processing an interval in any worker
+    double quad[MAXPROCS];           // result of each worker
+    long evaluations[MAXPROCS];      // function evaluations of each worker
+    struct Queue queues[MAXPROCS];   // one queue per worker
+};
+
+// add an interval to the queue
+void enqueue(struct Interval interval, struct Queue *queue_p)
+{
+    if (queue_p->top == MAXQUEUE - 1) {
+        printf("Maximum queue size exceeded - exiting\n");
+        exit(1);
+    }
+
+    queue_p->top++;
+
+    queue_p->entry[queue_p->top] = interval;
+}
+
+// extract last interval from queue
+struct Interval dequeue(struct Queue *queue_p)
+{
+    if (queue_p->top == -1) {
+        printf("Attempt to extract from empty queue - exiting\n");
+        exit(1);
+    }
+
+    struct Interval interval = queue_p->entry[queue_p->top];
+
+    queue_p->top--;
+
+    return interval;
+}
+
+// initialise queue
+void initialize(struct Queue *queue_p)
+{
+    pthread_mutexattr_t attr;
+
+    queue_p->top = -1;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&queue_p->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+// terminate queue
+void terminate(struct Queue *queue_p)
+{
+    pthread_mutex_destroy(&queue_p->lock);
+    queue_p->top = -1;
+}
+
+// return whether queue is empty
+int isempty(struct Queue *queue_p)
+{
+    int result = (queue_p->top == -1);
+
+    return result;
+}
+
+// get current number of queue entries
+int size(struct Queue *queue_p)
+{
+    return (queue_p->top + 1);
+}
+
+// Refine the whole interval breadth first until there are SEEDS intervals per
+// worker, then give each worker a contiguous run of them with roughly equal
+// estimated cost. The intervals are refined exactly as the workers would, so
+// the result does not depend on the number of processes. Returns the part of
+// the integral from intervals that already met the tolerance.
+double seed(const struct Integrand *integrand, double (*cost)(double), struct Interval whole,
+            struct Shared *shared, int procs, long *evaluations)
+{
+    static struct Interval levels[2][2 * SEEDS * MAXPROCS];
+    struct Interval *current = levels[0], *next = levels[1];
+    int count = 1, next_count;
+    double quad = 0.0;
+
+    current[0] = whole;
+
+    while (count > 0 && count < SEEDS * procs) {
+        next_count = 0;
+
+        for (int i = 0; i < count; ++i) {
+            struct Interval interval = current[i];
+
+            double h  = interval.right - interval.left;
+            double c  = (interval.left + interval.right) / 2.0;
+            double d  = (interval.left + c) / 2.0;
+            double e  = (c + interval.right) / 2.0;
+
+            double x[2] = { d, e };
+            double fx[2];
+            integrand->eval(x, fx, 2, integrand->data);
+            *evaluations += 2;
+            double fd = fx[0];
+            double fe = fx[1];
+
+            double q1 = h / 6.0  * (interval.f_left + 4.0 * interval.f_mid + interval.f_right);
+            double q2 = h / 12.0 * (interval.f_left + 4.0 * fd + 2.0 * interval.f_mid + 4.0 * fe + interval.f_right);
+
+            if ((fabs(q2 - q1) < interval.tol) ||
+                unresolvable(interval.left, interval.right, interval.f_left, fd, interval.f_mid, fe,
+                             interval.f_right, q1, q2, integrand->noise)) {
+                quad += q2 + (q2 - q1) / 15.0;
+                continue;
+            }
+
+            struct Interval *i1 = &next[next_count++];
+            struct Interval *i2 = &next[next_count++];
+
+            i1->left    = interval.left;
+            i1->right   = c;
+            i1->tol     = interval.tol;
+            i1->f_left  = interval.f_left;
+            i1->f_mid   = fd;
+            i1->f_right = interval.f_mid;
+
+            i2->left    = c;
+            i2->right   = interval.right;
+            i2->tol     = interval.tol;
+            i2->f_left  = interval.f_mid;
+            i2->f_mid   = fe;
+            i2->f_right = interval.f_right;
+        }
+
+        struct Interval *swap = current;
+        current = next;
+        next = swap;
+        count = next_count;
+    }
+
+    // Estimated cost of each interval from the trapezoidal rule on the cost
+    // model, then cut the intervals into runs of equal cumulative cost
+    double total = 0.0;
+    for (int i = 0; i < count; ++i) {
+        total += (current[i].right - current[i].left) * (cost(current[i].left) + cost(current[i].right)) / 2.0;
+    }
+
+    double cumulative = 0.0;
+    for (int i = 0; i < count; ++i) {
+        double interval_cost = (current[i].right - current[i].left) * (cost(current[i].left) + cost(current[i].right)) / 2.0;
+
+        // Assign by the cost midpoint of the interval
+        int owner = (int)((cumulative + interval_cost / 2.0) / total * procs);
+        if (owner >= procs)
+            owner = procs - 1;
+
+        enqueue(current[i], &shared->queues[owner]);
+        cumulative += interval_cost;
+    }
+
+    return quad;
+}
+
+// Restrict the calling process to the CPUs of a NUMA node. Returns the number
+// of CPUs of the node, or 0 if the node is unknown.
+int pin(int node)
+{
+    char path[128], list[4096];
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return 0;
+
+    bool ok = (fgets(list, sizeof(list), file) != NULL);
+    fclose(file);
+    if (!ok)
+        return 0;
+
+    // Parse a list of ranges such as "0-17,36-53"
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    char *range = strtok(list, ",\n");
+    while (range) {
+        int first, last;
+        int count = sscanf(range, "%d-%d", &first, &last);
+        if (count == 1)
+            last = first;
+
+        for (int cpu = first; count >= 1 && cpu <= last; ++cpu) {
+            CPU_SET(cpu, &set);
+        }
+
+        range = strtok(NULL, ",\n");
+    }
+
+    if (CPU_COUNT(&set) == 0 || sched_setaffinity(0, sizeof(set), &set) != 0)
+        return 0;
+
+    return CPU_COUNT(&set);
+}
+
+// Number of NUMA nodes of the machine
+int numa_nodes(void)
+{
+    int nodes = 0;
+    char path[128];
+
+    while (1) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", nodes);
+        if (access(path, F_OK) != 0)
+            break;
+        nodes++;
+    }
+
+    return nodes > 0 ? nodes : 1;
+}
+
+// Body of a worker process. Its threads take intervals from the worker's own
+// queue and steal from the queues of other workers when it is empty.
+void worker(const struct Integrand *integrand, struct Shared *shared, int id, int procs, int threads)
+{
+    assert(integrand && shared);
+
+    double quad = 0.0;
+    long evaluations = 0;
+
+#pragma omp parallel num_threads(threads) default(none) shared(integrand, shared, id, procs) reduction(+: quad, evaluations)
+{
+    struct Queue *local_queue = &shared->queues[id];
+
+    // Termination criteria must now be satisfied from within the loop
+    while (1) {
+        // Only read once work is set, initialised as the compiler can not tell
+        struct Interval interval = { 0 };
+        bool work = false;
+
+        // Try the local queue first, then the other workers' queues in a
+        // round robin fashion relative to this worker.
+        for (int attempt = 0; attempt < procs && !work; ++attempt) {
+            struct Queue *queue = &shared->queues[(id + attempt) % procs];
+
+            if (attempt == 0)
+                pthread_mutex_lock(&queue->lock);
+            else if (pthread_mutex_trylock(&queue->lock) != 0)
+                continue;
+
+            if (!isempty(queue)) {
+                // Count the thread as active before the interval leaves the
+                // queue so that it is never invisible to the termination check
+                __atomic_add_fetch(&shared->active_threads, 1, __ATOMIC_SEQ_CST);
+
+                interval = dequeue(queue);
+                work = true;
+            }
+            pthread_mutex_unlock(&queue->lock);
+        }
+
+        if (!work) {
+            // Only terminate once all queues are empty and no thread in any
+            // worker is processing an interval. The queues are checked first
+            // as an interval is counted as active before it is dequeued.
+            bool done = true;
+            for (int i = 0; i < procs && done; ++i) {
+                done = isempty(&shared->queues[i]);
+            }
+
+            int active = __atomic_load_n(&shared->active_threads, __ATOMIC_SEQ_CST);
+
+            if (done && active == 0)
+                break;
+
+            continue;
+        }
+
+        double h  = interval.right - interval.left;
+        double c  = (interval.left + interval.right) / 2.0;
+        double d  = (interval.left + c) / 2.0;
+        double e  = (c + interval.right) / 2.0;
+
+        // Both points are handed to the integrand in a single batch
+        double x[2] = { d, e };
+        double fx[2];
+        integrand->eval(x, fx, 2, integrand->data);
+        evaluations += 2;
+        double fd = fx[0];
+        double fe = fx[1];
+
+        // Calculate integral estimates using 3 and 5 points respectively
+        double q1 = h / 6.0  * (interval.f_left + 4.0 * interval.f_mid + interval.f_right);
+        double q2 = h / 12.0 * (interval.f_left + 4.0 * fd + 2.0 * interval.f_mid + 4.0 * fe + interval.f_right);
+
+        if ((fabs(q2 - q1) < interval.tol) ||
+            unresolvable(interval.left, interval.right, interval.f_left, fd, interval.f_mid, fe,
+                         interval.f_right, q1, q2, integrand->noise)) {
+            // Tolerance is met, add to total
+            quad += q2 + (q2 - q1) / 15.0;
+        } else {
+            // Tolerance is not met, split interval in two and add both halves to queue
+            struct Interval i1, i2;
+
+            i1.left    = interval.left;
+            i1.right   = c;
+            i1.tol     = interval.tol;
+            i1.f_left  = interval.f_left;
+            i1.f_mid   = fd;
+            i1.f_right = interval.f_mid;
+
+            i2.left    = c;
+            i2.right   = interval.right;
+            i2.tol     = interval.tol;
+            i2.f_left  = interval.f_mid;
+            i2.f_mid   = fe;
+            i2.f_right = interval.f_right;
+
+            pthread_mutex_lock(&local_queue->lock);
+            enqueue(i1, local_queue);
+            enqueue(i2, local_queue);
+            pthread_mutex_unlock(&local_queue->lock);
+        }
+
+        __atomic_sub_fetch(&shared->active_threads, 1, __ATOMIC_SEQ_CST);
+
+    } // while
+
+} // #pragma omp parallel
+
+    shared->quad[id] = quad;
+    shared->evaluations[id] += evaluations;
+}
+
+int main(int argc, char **argv)
+{
+    struct Integrand integrand = { func1_batch, NULL, NULL, 0, NULL, FUNC1_NOISE, func1_cost_hook };
+    struct Energy energy;
+
+    // One worker process per NUMA node unless given as: solver2_fork [procs]
+    int procs = (argc > 1) ? atoi(argv[1]) : numa_nodes();
+    if (procs < 1 || procs > MAXPROCS) {
+        printf("Number of processes must be between 1 and %d - exiting\n", MAXPROCS);
+        exit(1);
+    }
+
+    // Threads are divided between the workers. Reading the thread count does
+    // not start the OpenMP runtime, which must not happen before forking.
+    int threads = omp_get_max_threads() / procs;
+    if (threads < 1)
+        threads = 1;
+
+    printf("Processes: %d\n", procs);
+    printf("Threads: %d\n", procs * threads);
+    printf("Kernel variant: %s\n", kernel_variant());
+
+    // Map the queues and results into shared memory. The name is unlinked
+    // straight away, the mapping is inherited by the forked workers.
+    char name[64];
+    snprintf(name, sizeof(name), "/solver2_fork.%d", (int)getpid());
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(struct Shared)) != 0) {
+        printf("Failed to create shared memory - exiting\n");
+        exit(1);
+    }
+
+    struct Shared *shared = (struct Shared *)mmap(NULL, sizeof(struct Shared), PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED, fd, 0);
+    shm_unlink(name);
+    close(fd);
+
+    if (shared == MAP_FAILED) {
+        printf("Failed to map shared memory - exiting\n");
+        exit(1);
+    }
+
+    shared->active_threads = 0;
+    for (int i = 0; i < procs; ++i) {
+        initialize(&shared->queues[i]);
+        shared->quad[i] = 0.0;
+        shared->evaluations[i] = 0;
+    }
+
+    double start = omp_get_wtime();
+    energy_start(&energy);
+
+    // Create initial interval
+    struct Interval whole;
+    double x[3] = { 0.0, 10.0, 5.0 };
+    double fx[3];
+    integrand.eval(x, fx, 3, integrand.data);
+
+    whole.left    = x[0];
+    whole.right   = x[1];
+    whole.tol     = 1e-06;
+    whole.f_left  = fx[0];
+    whole.f_right = fx[1];
+    whole.f_mid   = fx[2];
+
+    // Split the work between the workers by the cost model of func1
+    long evaluations = 3;
+    double quad = seed(&integrand, func1_cost, whole, shared, procs, &evaluations);
+
+    int nodes = numa_nodes();
+    pid_t pids[MAXPROCS];
+
+    // Workers must not inherit and repeat buffered output
+    fflush(stdout);
+
+    for (int i = 0; i < procs; ++i) {
+        pids[i] = fork();
+
+        if (pids[i] < 0) {
+            printf("Failed to fork worker - exiting\n");
+            exit(1);
+        }
+
+        if (pids[i] == 0) {
+            // The worker still runs unpinned if the node is unknown
+            if (pin(i % nodes) == 0) {
+                printf("Worker %d not pinned to NUMA node %d\n", i, i % nodes);
+                fflush(stdout);
+            }
+
+            worker(&integrand, shared, i, procs, threads);
+            _exit(0);
+        }
+    }
+
+    bool failed = false;
+    for (int i = 0; i < procs; ++i) {
+        int status;
+        if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = true;
+    }
+
+    if (failed) {
+        printf("Worker process failed - exiting\n");
+        exit(1);
+    }
+
+    // Combine the results of the workers
+    for (int i = 0; i < procs; ++i) {
+        quad += shared->quad[i];
+        evaluations += shared->evaluations[i];
+    }
+
+    energy_stop(&energy);
+    double end = omp_get_wtime();
+
+    printf("Result = %e\n", quad);
+    printf("Time(s) = %f\n", end - start);
+    energy_report(&energy, 1, evaluations, stdout);
+
+    for (int i = 0; i < procs; ++i) {
+        terminate(&shared->queues[i]);
+    }
+
+    munmap(shared, sizeof(struct Shared));
+}
@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "function.h"
+#include "refine.h"
+#include "assist.h"
+#include "idle.h"
+#include "energy.h"
+#include "solver.h"
+#include "footprint.h"
+#include "stress.h"
+
+// Sub-queues per thread unless overridden by SOLVER_MULTI_QUEUES
+#define MULTI_FACTOR 2
+
+// Entries of a sub-queue when it is created, it doubles when full
+#define MAXQUEUE 10000
+
+struct Interval {
+    double left;     // left boundary
+    double right;    // right boundary
+    double tol;      // tolerance
+    double f_left;   // function value at left boundary
+    double f_mid;    // function value at midpoint
+    double f_right;  // function value at right boundary
+    double priority; // depth, or error estimate of the parent
+};
+
+// Sub-queues are binary heaps ordered on the priority of their intervals
+struct Queue {
+    struct Interval *entry; // heap of queue entries
+    int count;              // number of entries
+    int capacity;           // entries allocated
+    double best;            // priority of the first entry, -INFINITY if empty
+
+    omp_lock_t lock;        // Queue lock
+};
+
+// Order in which intervals are taken
+enum Priority {
+    PRIORITY_DEPTH, // deepest first, close to the LIFO order of the other solvers
+    PRIORITY_ERROR  // largest parent error first, for error driven refinement
+};
+
+// Order selected by SOLVER_PRIORITY. Returns false, leaving depth first, if it
+// names no order.
+bool priority_parse(enum Priority *priority)
+{
+    const char *name = getenv("SOLVER_PRIORITY");
+
+    *priority = PRIORITY_DEPTH;
+
+    if (!name || strcmp(name, "depth") == 0)
+        return true;
+    if (strcmp(name, "error") == 0) {
+        *priority = PRIORITY_ERROR;
+        return true;
+    }
+
+    return false;
+}
+
+// Per thread xorshift generator for picking sub-queues
+static inline uint32_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return (uint32_t)((*state * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+// add an interval to the queue
+void enqueue(struct Interval interval, struct Queue *queue_p, struct Footprint *footprint)
+{
+    if (queue_p->count == queue_p->capacity) {
+        queue_p->capacity *= 2;
+        queue_p->entry = (struct Interval *)realloc(queue_p->entry, sizeof(struct Interval) * queue_p->capacity);
+        if (!queue_p->entry) {
+            printf("Failed to grow queue - exiting\n");
+            exit(1);
+        }
+        footprint_alloc(footprint, sizeof(struct Interval) * queue_p->capacity / 2);
+    }
+
+    // Sift up from the end
+    int i = queue_p->count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (queue_p->entry[parent].priority >= interval.priority)
+            break;
+        queue_p->entry[i] = queue_p->entry[parent];
+        i = parent;
+    }
+    queue_p->entry[i] = interval;
+
+    #pragma omp atomic write
+    queue_p->best = queue_p->entry[0].priority;
+}
+
+// extract interval with the highest priority from queue
+struct Interval dequeue(struct Queue *queue_p)
+{
+    if (queue_p->count == 0) {
+        printf("Attempt to extract from empty queue - exiting\n");
+        exit(1);
+    }
+
+    struct Interval interval = queue_p->entry[0];
+    struct Interval last = queue_p->entry[--queue_p->count];
+
+    // Sift the last entry down from the root
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= queue_p->count)
+            break;
+        if (child + 1 < queue_p->count && queue_p->entry[child + 1].priority > queue_p->entry[child].priority)
+            child++;
+        if (last.priority >= queue_p->entry[child].priority)
+            break;
+        queue_p->entry[i] = queue_p->entry[child];
+        i = child;
+    }
+    if (queue_p->count > 0)
+        queue_p->entry[i] = last;
+
+    #pragma omp atomic write
+    queue_p->best = (queue_p->count > 0) ? queue_p->entry[0].priority : -INFINITY;
+
+    return interval;
+}
+
+// initialise queue
+void initialize(struct Queue *queue_p)
+{
+    queue_p->count = 0;
+    queue_p->capacity = MAXQUEUE;
+    queue_p->best = -INFINITY;
+    queue_p->entry = (struct Interval *)malloc(sizeof(struct Interval) * MAXQUEUE);
+    if (!queue_p->entry) {
+        printf("Failed to allocate queue - exiting\n");
+        exit(1);
+    }
+    omp_init_lock(&queue_p->lock);
+}
+
+// terminate queue
+void terminate(struct Queue *queue_p)
+{
+    omp_destroy_lock(&queue_p->lock);
+    free(queue_p->entry);
+    queue_p->count = 0;
+}
+
+// return whether queue is empty
+int isempty(struct Queue *queue_p)
+{
+    int result = (queue_p->count == 0);
+
+    return result;
+}
+
+// get current number of queue entries
+int size(struct Queue *queue_p)
+{
+    return queue_p->count;
+}
+
+// Priority of the first entry of a sub-queue, read without its lock
+static inline double best(struct Queue *queue_p)
+{
+    double priority;
+    #pragma omp atomic read
+    priority = queue_p->best;
+
+    return priority;
+}
+
+// Add an interval to a random sub-queue
+void push(struct Interval interval, struct Queue *queues, int queue_count, uint64_t *state,
+          struct Footprint *footprint)
+{
+    int q = next_random(state) % queue_count;
+
+    omp_set_lock(&queues[q].lock);
+    enqueue(interval, &queues[q], footprint);
+    footprint_push(footprint, q, size(&queues[q]));
+    omp_unset_lock(&queues[q].lock);
+}
+
+// Take the first interval of the better of two random sub-queues. As the
+// choice is made without their locks, the sub-queue may have been emptied in
+// the meantime, and a few pairs are drawn before every sub-queue is tried in
+// turn so that the last intervals are not missed.
+bool pop(struct Interval *interval, struct Queue *queues, int queue_count, uint64_t *state)
+{
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        int a = next_random(state) % queue_count;
+        int b = next_random(state) % queue_count;
+        int q = (best(&queues[b]) > best(&queues[a])) ? b : a;
+
+        if (best(&queues[q]) == -INFINITY)
+            continue;
+
+        omp_set_lock(&queues[q].lock);
+        if (!isempty(&queues[q])) {
+            *interval = dequeue(&queues[q]);
+            omp_unset_lock(&queues[q].lock);
+            return true;
+        }
+        omp_unset_lock(&queues[q].lock);
+    }
+
+    int start = next_random(state) % queue_count;
+
+    for (int i = 0; i < queue_count; ++i) {
+        int q = (start + i) % queue_count;
+
+        if (best(&queues[q]) == -INFINITY)
+            continue;
+
+        omp_set_lock(&queues[q].lock);
+        if (!isempty(&queues[q])) {
+            *interval = dequeue(&queues[q]);
+            omp_unset_lock(&queues[q].lock);
+            return true;
+        }
+        omp_unset_lock(&queues[q].lock);
+    }
+
+    return false;
+}
+
+// pending is the number of intervals queued or being processed. Taking an
+// interval does not change it, so a single counter tells when the work has
+// run out: a thread adds the net interval of a split before queueing the
+// halves and removes an accepted interval once it is added to quad.
+double simpson(const struct Integrand *integrand, struct Queue *queues, int queue_count, int thread_count,
+               enum IdleMode mode, long pending, enum Priority priority, struct SolverStats *stats)
+{
+    assert(integrand && queues && stats);
+
+    double quad = 0.0;
+    long evaluations = 0;
+    int team = 0;
+
+    // Keeps track of number of threads currently processing intervals, which
+    // decides when to share work with idle threads or park them. Termination
+    // only looks at pending.
+    int active_threads = 0;
+
+    // Help slots through which threads share the evaluation of an interval
+    // with idle threads once there are too few intervals to go around.
+    struct Assist *slots = (struct Assist *)malloc(sizeof(struct Assist) * thread_count);
+    if (!slots) {
+        printf("Failed to allocate help slots - exiting\n");
+        exit(1);
+    }
+
+    struct Footprint *footprint = stats->footprint;
+    footprint_alloc(footprint, sizeof(struct Assist) * thread_count);
+
+    struct Counters *counters = stats->counters;
+
+    for (int i = 0; i < thread_count; ++i) {
+        assist_init(&slots[i]);
+    }
+
+    // Threads without work may park while there are too few queued intervals
+    // The idle state is kept in the caller's if it wants to report it
+    struct Idle local_idle;
+    struct Idle *idle = stats->idle ? stats->idle : &local_idle;
+    idle_init(idle, thread_count, mode);
+
+    // Offering work to helpers that may not get a core only makes the owner wait
+    bool sharing = (assist_enabled() && idle->mode != IDLE_YIELD && idle->mode != IDLE_AUTO);
+
+#pragma omp parallel num_threads(thread_count) default(none) shared(integrand, queues, queue_count, pending, priority, active_threads, slots, thread_count, idle, sharing, footprint, counters, team) reduction(+: quad, evaluations)
+{
+    int thread_id = omp_get_thread_num();
+
+    // Thread 0 notes how many threads the team really has
+    if (thread_id == 0)
+        team = omp_get_num_threads();
+    uint64_t state = 0x9e3779b97f4a7c15ULL * (thread_id + 1);
+
+    int events[COUNTERS_EVENTS];
+    counters_thread_start(counters, events);
+
+    // Already have function values at left and right boundaries and midpoint
+    // Now evaluate function at one-qurter and three-quarter points
+    struct Interval interval;
+
+    // Termination criteria must now be satisfied from within the loop
+    while (1) {
+        long left;
+        int busy;
+
+        // A sample is taken by whichever thread finds it due
+        if (footprint_claim(footprint)) {
+            #pragma omp atomic read
+            left = pending;
+            #pragma omp atomic read
+            busy = active_threads;
+            footprint_sample(footprint, (int)(left - busy));
+        }
+
+        bool work = pop(&interval, queues, queue_count, &state);
+        if (work) {
+            STRESS_DELAY(STRESS_DEQUEUE);
+            #pragma omp atomic
+            active_threads++;
+        }
+
+        // Only terminate once no interval is queued or being processed
+        STRESS_DELAY(STRESS_TERMINATE);
+        #pragma omp atomic read
+        left = pending;
+
+        if (left == 0) {
+            STRESS_EXIT();
+            idle_stop(idle);
+            counters_thread_stop(counters, events);
+            break;
+        }
+
+        // Help evaluate another thread's interval while waiting for work, or
+        // park if there is nothing to help with
+        if (!work) {
+            if (!assist_help(slots, thread_count, thread_id)) {
+                #pragma omp atomic read
+                busy = active_threads;
+
+                idle_wait(idle, (int)(left - busy), busy);
+            }
+            continue;
+        }
+
+        double h  = interval.right - interval.left;
+        double c  = (interval.left + interval.right) / 2.0;
+        double d  = (interval.left + c) / 2.0;
+        double e  = (c + interval.right) / 2.0;
+
+        // Both points are handed to the integrand in a single batch. If there
+        // are fewer queued intervals than idle threads, offer one of the
+        // points to an idle thread.
+        #pragma omp atomic read
+        busy = active_threads;
+
+        bool share = (sharing && (int)(left - busy) < thread_count - busy);
+
+        double x[2] = { d, e };
+        double fx[2];
+        assist_eval(&slots[thread_id], idle, integrand, x, fx, 2, share);
+        evaluations += 2;
+        double fd = fx[0];
+        double fe = fx[1];
+
+        // Calculate integral estimates using 3 and 5 points respectively
+        double q1 = h / 6.0 * (interval.f_left + 4.0 * interval.f_mid + interval.f_right);
+        double q2 = h / 12.0 * (interval.f_left + 4.0 * fd + 2.0 * interval.f_mid + 4.0 * fe + interval.f_right);
+
+        if ((fabs(q2 - q1) < interval.tol) ||
+            unresolvable(interval.left, interval.right, interval.f_left, fd, interval.f_mid, fe,
+                         interval.f_right, q1, q2, integrand->noise)) {
+            // Note that each thread has its own local copy of quad because of reduction clause
+            // Tolerance is met, add to total
+            quad += q2 + (q2 - q1) / 15.0;
+
+            STRESS_WORK_DONE();
+            #pragma omp atomic
+            pending--;
+        } else {
+            // Tolerance is not met, split interval in two and add both halves to queue
+            struct Interval i1, i2;
+
+            i1.left    = interval.left;
+            i1.right   = c;
+            i1.tol     = interval.tol;
+            i1.f_left  = interval.f_left;
+            i1.f_mid   = fd;
+            i1.f_right = interval.f_mid;
+
+            i2.left    = c;
+            i2.right   = interval.right;
+            i2.tol     = interval.tol;
+            i2.f_left  = interval.f_mid;
+            i2.f_mid   = fe;
+            i2.f_right = interval.f_right;
+
+            i1.priority = i2.priority = (priority == PRIORITY_DEPTH) ? interval.priority + 1.0 : fabs(q2 - q1);
+
+            // Count the halves before they can be taken, so that pending never
+            // drops to zero while work is left
+            #pragma omp atomic
+            pending++;
+            STRESS_WORK_DONE();
+
+            // Each half goes to its own random sub-queue
+            push(i1, queues, queue_count, &state, footprint);
+            push(i2, queues, queue_count, &state, footprint);
+
+            // Unpark threads if there are now more intervals than threads
+            // polling for them
+            #pragma omp atomic read
+            left = pending;
+            #pragma omp atomic read
+            busy = active_threads;
+
+            idle_notify(idle, (int)(left - busy), busy);
+        }
+
+        #pragma omp atomic
+        active_threads--;
+
+    } // while
+
+} // #pragma omp parallel
+
+    if (idle == &local_idle)
+        idle_destroy(idle);
+
+    for (int i = 0; i < thread_count; ++i) {
+        assist_destroy(&slots[i]);
+    }
+
+    free(slots);
+
+    stats->evaluations += evaluations;
+    stats->threads = team;
+
+    return quad;
+}
+
+double integrate(const struct Integrand *integrand, double left, double right, double tol,
+                 struct SolverStats *stats)
+{
+    assert(integrand);
+
+    struct SolverStats local = { 0 };
+    if (!stats)
+        stats = &local;
+
+    // An invalid SOLVER_IDLE was already rejected by the caller
+    enum IdleMode mode;
+    idle_mode_parse(&mode);
+
+    int thread_count = idle_team_size(mode, omp_get_max_threads());
+    // An invalid SOLVER_PRIORITY was already rejected by the caller
+    enum Priority priority;
+    priority_parse(&priority);
+
+    // c sub-queues for each thread
+    int factor = MULTI_FACTOR;
+    const char *setting = getenv("SOLVER_MULTI_QUEUES");
+    if (setting && atoi(setting) > 0)
+        factor = atoi(setting);
+    int queue_count = factor * thread_count;
+
+    struct Queue *queues = (struct Queue *)malloc(sizeof(struct Queue) * queue_count);
+    if (!queues) {
+        printf("Failed to allocate queues - exiting\n");
+        exit(1);
+    }
+
+    // Initialise queues
+    for (int i = 0; i < queue_count; ++i) {
+        initialize(&queues[i]);
+    }
+
+    if (stats->footprint) {
+        footprint_init(stats->footprint, queue_count, MAXQUEUE, sizeof(struct Interval));
+        footprint_alloc(stats->footprint, (sizeof(struct Queue) + sizeof(struct Interval) * MAXQUEUE) * queue_count);
+    }
+
+    // Split the domain at the integrand's breakpoints, so that no interval
+    // has to be refined down to a jump, and deal the pieces to the sub-queues
+    struct Piece *pieces;
+    int count = integrand_pieces(integrand, left, right, &pieces);
+    stats->evaluations = 3 * count;
+    stats->speculated = 0;
+    stats->wasted = 0;
+
+    for (int i = 0; i < count; ++i) {
+        struct Interval piece;
+
+        piece.left     = pieces[i].left;
+        piece.right    = pieces[i].right;
+        piece.tol      = tol;
+        piece.f_left   = pieces[i].f_left;
+        piece.f_right  = pieces[i].f_right;
+        piece.f_mid    = pieces[i].f_mid;
+        piece.priority = (priority == PRIORITY_DEPTH) ? 0.0 : INFINITY;
+
+        enqueue(piece, &queues[i % queue_count], stats->footprint);
+        footprint_push(stats->footprint, i % queue_count, size(&queues[i % queue_count]));
+    }
+
+    free(pieces);
+
+    // Call queue-based quadrature routine
+    double quad = simpson(integrand, queues, queue_count, thread_count, mode, count, priority, stats);
+
+    for (int i = 0; i < queue_count; ++i) {
+        terminate(&queues[i]);
+    }
+
+    free(queues);
+
+    return quad;
+}
+
+#ifndef SOLVER_LIBRARY
+int main(void)
+{
+    struct Integrand integrand = { func1_batch, NULL, NULL, 0, NULL, FUNC1_NOISE, func1_cost_hook };
+    struct SolverStats stats = { 0 };
+
+    // Split the domain at the jumps of func1 with SOLVER_BREAKPOINTS=1. Off by
+    // default as the pieces alias with the sine, see the README.
+    const char *breakpoints = getenv("SOLVER_BREAKPOINTS");
+    if (breakpoints && atoi(breakpoints) != 0)
+        integrand.breakpoints = func1_breakpoints;
+
+    // Checked here as integrate falls back to spinning on a bad value
+    enum IdleMode idle_mode = idle_mode_from_env();
+
+    enum Priority priority;
+    if (!priority_parse(&priority)) {
+        printf("Unknown SOLVER_PRIORITY %s - exiting\n", getenv("SOLVER_PRIORITY"));
+        exit(1);
+    }
+    struct Energy energy;
+    struct Footprint footprint;
+    struct Counters counters;
+    stats.footprint = &footprint;
+    stats.counters = &counters;
+    counters_init(&counters);
+
+    struct Idle idle;
+    stats.idle = &idle;
+
+    double start = omp_get_wtime();
+    energy_start(&energy);
+
+    printf("Threads: %d\n", omp_get_max_threads());
+    int team = idle_team_size(idle_mode, omp_get_max_threads());
+    if (team < omp_get_max_threads())
+        printf("Team limited to %d threads (requested %d)\n", team, omp_get_max_threads());
+    printf("Kernel variant: %s\n", kernel_variant());
+
+    double quad = integrate(&integrand, 0.0, 10.0, 1e-06, &stats);
+
+    energy_stop(&energy);
+    double end = omp_get_wtime();
+
+    printf("Result = %e\n", quad);
+    printf("Time(s) = %f\n", end - start);
+    energy_report(&energy, 1, stats.evaluations, stdout);
+    idle_report(&idle, stdout);
+    idle_destroy(&idle);
+
+    counters_report(&counters, stats.evaluations, stdout);
+    footprint_report(&footprint, stdout);
+    footprint_json(&footprint, "solver2_multi", stats.threads, quad, end - start, stats.evaluations);
+    footprint_destroy(&footprint);
+}
+#endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <assert.h>
@@ -7,9 +8,35 @@
 #include <omp.h>
 
 #include "function.h"
+#include "refine.h"
+#include "solver.h"
+#include "assist.h"
+#include "idle.h"
+#include "energy.h"
+#include "memo.h"
+#include "footprint.h"
+#include "stress.h"
+#include "cost.h"
+#include "expr.h"
 
 #define MAXQUEUE 10000
 
+// Most intervals pushed to an idle thread at once
+#define MAILBOX_SIZE 4
+
+// Number of entries below the top prefetched after a dequeue
+#define PREFETCH_DEPTH 2
+
+// Number of oldest entries a thief searches for the costliest one
+#define STEAL_WINDOW 8
+
+// Prefetch for reading, compiles to nothing where the builtin is missing
+#if defined(__GNUC__)
+#define PREFETCH(address) __builtin_prefetch(address, 0, 3)
+#else
+#define PREFETCH(address)
+#endif
+
 struct Interval {
     double left;    // left boundary
     double right;   // right boundary
@@ -17,11 +44,18 @@ struct Interval {
     double f_left;  // function value at left boundary
     double f_mid;   // function value at midpoint
     double f_right; // function value at right boundary
+    double error;   // |q2 - q1| of the parent interval
+    bool evaluated; // quarter points were evaluated speculatively
+    double f_d;     // function value at one-quarter point if evaluated
+    double f_e;     // function value at three-quarter point if evaluated
+    double cost;    // estimated cost of refining the interval
 };
 
 struct Queue {
     struct Interval entry[MAXQUEUE]; // array of queue entries
     int16_t top;                     // index of last entry
+    int16_t bottom;                  // index of first entry
+    double cost;                     // estimated cost of all entries
     omp_lock_t lock;                 // Queue lock    
 };
 
@@ -29,8 +63,21 @@ struct Queue {
 void enqueue(struct Interval interval, struct Queue *queue_p)
 {
     if (queue_p->top == MAXQUEUE - 1) {
-        printf("Maximum queue size exceeded - exiting\n");
-        exit(1);
+        if (queue_p->bottom == 0) {
+            printf("Maximum queue size exceeded - exiting\n");
+            exit(1);
+        }
+
+        // Move the entries down over those taken from the bottom. Lowering the
+        // bottom first means a reader without the lock can only see too many
+        // entries, never an empty queue.
+        int16_t bottom = queue_p->bottom;
+        memmove(&queue_p->entry[0], &queue_p->entry[bottom],
+                sizeof(struct Interval) * (queue_p->top - bottom + 1));
+#pragma omp atomic write
+        queue_p->bottom = 0;
+#pragma omp atomic
+        queue_p->top -= bottom;
     }
 
     // Ensure that memory location of top is incremented by a single thread as
@@ -40,12 +87,26 @@ void enqueue(struct Interval interval, struct Queue *queue_p)
     queue_p->top++;
 
     queue_p->entry[queue_p->top] = interval;
+
+#pragma omp atomic
+    queue_p->cost += interval.cost;
+}
+
+// start again from the beginning of the array once the queue is empty
+static void rewind_empty(struct Queue *queue_p)
+{
+    if (queue_p->top < queue_p->bottom) {
+#pragma omp atomic write
+        queue_p->top = -1;
+#pragma omp atomic write
+        queue_p->bottom = 0;
+    }
 }
 
 // extract last interval from queue
 struct Interval dequeue(struct Queue *queue_p)
 {
-    if (queue_p->top == -1) {
+    if (queue_p->top < queue_p->bottom) {
         printf("Attempt to extract from empty queue - exiting\n");
         exit(1);
     }
@@ -59,13 +120,83 @@ struct Interval dequeue(struct Queue *queue_p)
 #pragma omp atomic
     queue_p->top--;
 
+#pragma omp atomic
+    queue_p->cost -= interval.cost;
+
+    rewind_empty(queue_p);
+
+    return interval;
+}
+
+// extract the costliest of the STEAL_WINDOW oldest intervals from queue. With
+// LIFO order the costliest interval is usually one of the oldest, and only
+// the entries below it are moved up, so a steal takes bounded time.
+struct Interval dequeue_costliest(struct Queue *queue_p)
+{
+    int bottom = queue_p->bottom;
+    int end = bottom + STEAL_WINDOW - 1;
+    if (end > queue_p->top)
+        end = queue_p->top;
+
+    int costliest = bottom;
+    for (int i = bottom + 1; i <= end; ++i) {
+        if (queue_p->entry[i].cost > queue_p->entry[costliest].cost)
+            costliest = i;
+    }
+
+    struct Interval interval = queue_p->entry[costliest];
+    memmove(&queue_p->entry[bottom + 1], &queue_p->entry[bottom],
+            sizeof(struct Interval) * (costliest - bottom));
+
+#pragma omp atomic
+    queue_p->bottom++;
+
+#pragma omp atomic
+    queue_p->cost -= interval.cost;
+
+    rewind_empty(queue_p);
+
     return interval;
 }
 
+// prefetch the cache lines of the entry at index i of the queue
+static inline void prefetch_entry(struct Queue *queue_p, int i)
+{
+    PREFETCH(&queue_p->entry[i]);
+    PREFETCH((char *)&queue_p->entry[i + 1] - 1);
+}
+
+// prefetch the entries the next dequeues will read. The top may be changed by
+// a thread holding the lock, which only makes the prefetch useless.
+void prefetch_top(struct Queue *queue_p, int depth)
+{
+    int top;
+    #pragma omp atomic read
+    top = queue_p->top;
+
+    for (int i = top; i >= 0 && i > top - depth; --i) {
+        prefetch_entry(queue_p, i);
+    }
+}
+
+// prefetch the oldest entries, among which a costliest steal searches
+void prefetch_bottom(struct Queue *queue_p, int depth)
+{
+    int bottom;
+    #pragma omp atomic read
+    bottom = queue_p->bottom;
+
+    for (int i = bottom; i < MAXQUEUE && i < bottom + depth; ++i) {
+        prefetch_entry(queue_p, i);
+    }
+}
+
 // initialise queue
 void initialize(struct Queue *queue_p)
 {
     queue_p->top = -1;
+    queue_p->bottom = 0;
+    queue_p->cost = 0.0;
     omp_init_lock(&queue_p->lock);
 }
 
@@ -74,12 +205,13 @@ void terminate(struct Queue *queue_p)
 {
     omp_destroy_lock(&queue_p->lock);
     queue_p->top = -1;
+    queue_p->bottom = 0;
 }
 
 // return whether queue is empty
 int isempty(struct Queue *queue_p)
 {
-    int result = (queue_p->top == -1);
+    int result = (queue_p->top < queue_p->bottom);
 
     return result;
 }
@@ -87,66 +219,327 @@ int isempty(struct Queue *queue_p)
 // get current number of queue entries
 int size(struct Queue *queue_p)
 {
-    return (queue_p->top + 1);
+    return (queue_p->top - queue_p->bottom + 1);
+}
+
+// extract the n oldest intervals from queue, which are the widest ones
+void dequeue_oldest(struct Queue *queue_p, struct Interval *intervals, int n)
+{
+    if (n > size(queue_p)) {
+        printf("Attempt to extract more entries than queued - exiting\n");
+        exit(1);
+    }
+
+    double cost = 0.0;
+    for (int i = 0; i < n; ++i) {
+        intervals[i] = queue_p->entry[queue_p->bottom + i];
+        cost += intervals[i].cost;
+    }
+
+#pragma omp atomic
+    queue_p->bottom += n;
+
+#pragma omp atomic
+    queue_p->cost -= cost;
+
+    rewind_empty(queue_p);
+}
+
+// Mailbox through which a thread with surplus work pushes intervals to an
+// idle thread. A sender first claims the idle thread by clearing its bit in
+// the idle bitmap, which makes it the only producer until the owner, the only
+// consumer, has collected the intervals and advertised itself again.
+struct Mailbox {
+    struct Interval entry[MAILBOX_SIZE];
+    int count; // intervals posted, 0 once collected
+};
+
+// Mark a thread as idle in the bitmap
+static void advertise(uint64_t *idle_bits, int thread)
+{
+    uint64_t mask = (uint64_t)1 << (thread % 64);
+
+    // Reads of the last mailbox contents complete before a sender can claim
+    #pragma omp flush
+    #pragma omp atomic
+    idle_bits[thread / 64] |= mask;
 }
 
+// Clear the bit of a thread and return whether it was set, so that of several
+// threads clearing it only one succeeds
+static bool claim(uint64_t *idle_bits, int thread)
+{
+    uint64_t mask = (uint64_t)1 << (thread % 64);
+    uint64_t old;
+
+    #pragma omp atomic capture
+    { old = idle_bits[thread / 64]; idle_bits[thread / 64] &= ~mask; }
 
+    return (old & mask) != 0;
+}
 
-double simpson(double (*func)(double), struct Queue *queues, int queues_size)
+// Claim the first idle thread after self, or return -1 if there is none
+static int claim_idle(uint64_t *idle_bits, int threads, int self)
 {
-    assert(func && queues);
+    bool any = false;
+    for (int w = 0; w < (threads + 63) / 64 && !any; ++w) {
+        uint64_t bits;
+        #pragma omp atomic read
+        bits = idle_bits[w];
+        any = (bits != 0);
+    }
+    if (!any)
+        return -1;
+
+    for (int i = 1; i < threads; ++i) {
+        int other = (self + i) % threads;
+
+        uint64_t bits;
+        #pragma omp atomic read
+        bits = idle_bits[other / 64];
+
+        if (((bits >> (other % 64)) & 1) && claim(idle_bits, other))
+            return other;
+    }
+
+    return -1;
+}
+
+
+
+double simpson(const struct Integrand *integrand, struct Queue *queues, int queues_size,
+               enum IdleMode mode, double speculation, bool prefetch, bool pushing, struct CostModel *model,
+               struct SolverStats *stats)
+{
+    assert(integrand && queues && stats);
 
     double quad = 0.0;
+    long evaluations = 0, speculated = 0, wasted = 0;
+    long batches = 0, pushed = 0;
+    int team = 0;
 
     // Keeps track of number of threads currently processing intervals so that 
     // we only terminate if both the queue is empty and no threads are 
     // processing.
     int active_threads = 0;
+
+    // Help slots through which threads share the evaluation of an interval
+    // with idle threads once there are too few intervals to go around.
+    struct Assist *slots = (struct Assist *)malloc(sizeof(struct Assist) * queues_size);
+    if (!slots) {
+        printf("Failed to allocate help slots - exiting\n");
+        exit(1);
+    }
+
+    struct Footprint *footprint = stats->footprint;
+    footprint_alloc(footprint, sizeof(struct Assist) * queues_size);
+
+    struct Counters *counters = stats->counters;
+
+    // With a cost model thieves take the most expensive interval of the
+    // queue with the largest estimated cost, so that the last intervals left
+    // are cheap ones
+    bool costs = (model->mode != COST_NONE);
+
+    for (int i = 0; i < queues_size; ++i) {
+        assist_init(&slots[i]);
+    }
+
+    // Threads without work may park while there are too few queued intervals.
+    // The total number of queued intervals is only tracked when parking.
+    // The idle state is kept in the caller's if it wants to report it
+    struct Idle local_idle;
+    struct Idle *idle = stats->idle ? stats->idle : &local_idle;
+    idle_init(idle, queues_size, mode);
+
+    // Offering work to helpers that may not get a core only makes the owner wait
+    bool sharing = (assist_enabled() && idle->mode != IDLE_YIELD && idle->mode != IDLE_AUTO);
+
+    int queued = 0;
+    for (int i = 0; i < queues_size; ++i) {
+        queued += size(&queues[i]);
+
+        // Threads start out holding their seeded intervals when pushing
+        if (pushing && !isempty(&queues[i]))
+            active_threads++;
+    }
+
+    // When pushing work, idle threads advertise themselves in a bitmap and
+    // wait for intervals in their mailbox rather than stealing
+    uint64_t *idle_bits = (uint64_t *)calloc((queues_size + 63) / 64, sizeof(uint64_t));
+    struct Mailbox *mailboxes = (struct Mailbox *)calloc(queues_size, sizeof(struct Mailbox));
+    if (!idle_bits || !mailboxes) {
+        printf("Failed to allocate mailboxes - exiting\n");
+        exit(1);
+    }
+    footprint_alloc(footprint, sizeof(uint64_t) * ((queues_size + 63) / 64) + sizeof(struct Mailbox) * queues_size);
     
-    #pragma omp parallel default(none) shared(func, queues, active_threads, queues_size) reduction(+: quad)
+    #pragma omp parallel num_threads(queues_size) default(none) shared(integrand, queues, active_threads, queues_size, slots, idle, queued, sharing, speculation, prefetch, pushing, idle_bits, mailboxes, footprint, counters, model, costs, team) reduction(+: quad, evaluations, speculated, wasted, batches, pushed)
     {
         int thread_id = omp_get_thread_num();
         struct Queue *local_queue = &queues[thread_id];
+        struct Mailbox *mailbox = &mailboxes[thread_id];
+
+        // The runtime may give the team fewer threads than requested
+        if (thread_id == 0)
+            team = omp_get_num_threads();
+
+        // Set from advertising in the bitmap until the pushed intervals are
+        // collected
+        bool advertised = false;
+
+        // When pushing, a thread counts as active while it holds any work,
+        // queued or not, so that active_threads only reaches 0 at the end
+        bool counted = pushing && !isempty(local_queue);
+
+        int events[COUNTERS_EVENTS];
+        counters_thread_start(counters, events);
         
         // Termination criteria must now be satisfied from within the loop
         while (1) {
             // Already have function values at left and right boundaries and midpoint
-            // Now evaluate function at one-qurter and three-quarter points
-            struct Interval interval;
+            // Now evaluate function at one-qurter and three-quarter points.
+            // The interval is zeroed for the position independent build,
+            // where the compiler loses track of thread_has_work.
+            struct Interval interval = { 0 };
             bool thread_has_work = false;
 
+            // Any thread polling its queue samples the number of queued
+            // intervals when a sample is due
+            if (footprint_claim(footprint)) {
+                int frontier = 0;
+                for (int i = 0; i < queues_size; ++i) {
+                    frontier += size(&queues[i]);
+                }
+                footprint_sample(footprint, frontier);
+            }
+
+            // Move intervals pushed by another thread to the local queue
+            if (pushing && advertised) {
+                int count;
+                #pragma omp atomic read
+                count = mailbox->count;
+
+                if (count > 0) {
+                    #pragma omp flush
+                    omp_set_lock(&local_queue->lock);
+                    for (int i = 0; i < count; ++i) {
+                        enqueue(mailbox->entry[i], local_queue);
+                    }
+                    footprint_push(footprint, thread_id, size(local_queue));
+                    omp_unset_lock(&local_queue->lock);
+
+                    #pragma omp atomic write
+                    mailbox->count = 0;
+                    advertised = false;
+
+                    // Take over the count of the pushed intervals
+                    counted = true;
+                }
+            }
+
             omp_set_lock(&local_queue->lock);
             {
                 if (!isempty(local_queue)) {
                     interval = dequeue(local_queue);
                     thread_has_work = true;
+                    STRESS_DELAY(STRESS_DEQUEUE);
+
+                    // If this interval is accepted the next entry popped was
+                    // pushed long ago and is likely cold, so start fetching
+                    // it while the interval is evaluated
+                    if (prefetch)
+                        prefetch_top(local_queue, PREFETCH_DEPTH);
 
                     // Ensure that enqueuing or dequeuing does not try to modify 
                     // active_threads at the same time.
+                    if (!counted) {
+                        #pragma omp atomic
+                        active_threads++;
+                    }
+                    counted = pushing;
+                }
+
+                // Push the oldest half of any remaining intervals, up to a
+                // mailbox full, to an idle thread. The intervals count as an
+                // active thread until collected, so that nobody terminates
+                // while they are in the mailbox.
+                int receiver = -1;
+                if (pushing && thread_has_work && !isempty(local_queue))
+                    receiver = claim_idle(idle_bits, queues_size, thread_id);
+
+                if (receiver >= 0) {
+                    struct Mailbox *other = &mailboxes[receiver];
+                    int n = (size(local_queue) + 1) / 2;
+                    if (n > MAILBOX_SIZE)
+                        n = MAILBOX_SIZE;
+
+                    dequeue_oldest(local_queue, other->entry, n);
+
                     #pragma omp atomic
                     active_threads++;
+
+                    #pragma omp flush
+                    #pragma omp atomic write
+                    other->count = n;
+
+                    batches++;
+                    pushed += n;
                 }
             }
             omp_unset_lock(&local_queue->lock);
 
-            if (!thread_has_work) {
+            // Advertise instead of stealing when pushing
+            if (!thread_has_work && pushing && !advertised) {
+                advertise(idle_bits, thread_id);
+                advertised = true;
+            }
+
+            if (!thread_has_work && !pushing) {
+                // Try the queue with the largest estimated cost first
+                int costliest = thread_id;
+                if (costs) {
+                    double largest = 0.0;
+                    for (int i = 0; i < queues_size; ++i) {
+                        double cost;
+                        #pragma omp atomic read
+                        cost = queues[i].cost;
+
+                        if (i != thread_id && cost > largest) {
+                            largest = cost;
+                            costliest = i;
+                        }
+                    }
+                }
+
                 // Attempt to steal work in a round robin fashion relative 
                 // from the current thread. This is so that earlier threads
                 // do not get a lot of work load.
                 for (int attempt = 0; attempt < queues_size; ++attempt) {
-                    // Next thread relative to current thread
-                    int other_thread_id = (thread_id + attempt) % queues_size;
-                    if (other_thread_id == thread_id)
+                    // Next thread relative to current thread, after the
+                    // costliest queue
+                    int other_thread_id = (attempt == 0) ? costliest : (thread_id + attempt) % queues_size;
+                    if (other_thread_id == thread_id || (attempt > 0 && other_thread_id == costliest))
                         continue;
 
                     struct Queue *other_queue = &queues[other_thread_id];
 
+                    // Start fetching the entries a steal would read before
+                    // contending for the lock, to shorten the time it is held
+                    if (prefetch) {
+                        if (costs)
+                            prefetch_bottom(other_queue, STEAL_WINDOW);
+                        else
+                            prefetch_top(other_queue, 1);
+                    }
+
                     // Attempt to steal work from another thread. If the other 
                     // queue is locked then skip and try another queue.
                     if (omp_test_lock(&other_queue->lock)) {
                         if (!isempty(other_queue)) {
-                            interval = dequeue(other_queue);
+                            interval = costs ? dequeue_costliest(other_queue) : dequeue(other_queue);
                             thread_has_work = true;
+                            STRESS_DELAY(STRESS_STEAL);
 
                             // Ensure that enqueuing or dequeuing does not try to modify 
                             // active_threads at the same time.
@@ -165,31 +558,96 @@ double simpson(double (*func)(double), struct Queue *queues, int queues_size)
             // Checking if a queue is empty is not enough as other threads 
             // might be currently processing intervals. Only terminate if
             // both the queue is empty and no threads are executing.
+            STRESS_DELAY(STRESS_TERMINATE);
             bool terminate = (isempty(local_queue) && active_threads == 0);
+
+            // A thread that was claimed by a sender waits for its intervals
+            if (terminate && advertised && !claim(idle_bits, thread_id))
+                terminate = false;
+
             if (terminate) {
+                STRESS_EXIT();
+                idle_stop(idle);
+                counters_thread_stop(counters, events);
                 break;
             }
 
-            // If the thread has no work then go back to the start
+            // If the thread has no work then help evaluate another thread's
+            // interval, or park if there is nothing to help with, and go back
+            // to the start
             if (!thread_has_work) {
+                // A parked thread would not notice intervals pushed to it
+                if (!assist_help(slots, queues_size, thread_id) && idle->mode != IDLE_SPIN &&
+                    !(pushing && idle->mode == IDLE_PARK)) {
+                    int waiting, busy;
+                    #pragma omp atomic read
+                    waiting = queued;
+                    #pragma omp atomic read
+                    busy = active_threads;
+
+                    idle_wait(idle, waiting, busy);
+                }
                 continue;
             }
 
+            if (idle->mode == IDLE_PARK) {
+                #pragma omp atomic
+                queued--;
+            }
+
             double h  = interval.right - interval.left;
             double c  = (interval.left + interval.right) / 2.0;
             double d  = (interval.left + c) / 2.0;
             double e  = (c + interval.right) / 2.0;
-            double fd = func(d);
-            double fe = func(e);
+
+            // Both points are handed to the integrand in a single batch. If
+            // this thread has nothing queued for others to steal while some
+            // threads are idle, offer one of the points to an idle thread.
+            int busy;
+            #pragma omp atomic read
+            busy = active_threads;
+
+            bool share = (sharing && isempty(local_queue) && busy < queues_size);
+
+            // An interval whose parent was far from the tolerance will likely
+            // split as well, so the quarter points of both its children are
+            // evaluated in the same batch. The children are then queued with
+            // their quarter points already evaluated.
+            bool speculate = (!interval.evaluated && speculation > 0.0 &&
+                              interval.error > speculation * interval.tol);
+
+            double x[6] = { d, e, (interval.left + d) / 2.0, (d + c) / 2.0, (c + e) / 2.0, (e + interval.right) / 2.0 };
+            double fx[6];
+
+            if (interval.evaluated) {
+                fx[0] = interval.f_d;
+                fx[1] = interval.f_e;
+            } else {
+                int n = speculate ? 6 : 2;
+                double timed = (model->mode == COST_LEARNED) ? omp_get_wtime() : 0.0;
+                assist_eval(&slots[thread_id], idle, integrand, x, fx, n, share);
+                if (model->mode == COST_LEARNED)
+                    cost_record(model, c, n, omp_get_wtime() - timed);
+                evaluations += n;
+                speculated += n - 2;
+            }
+
+            double fd = fx[0];
+            double fe = fx[1];
 
             // Calculate integral estimates using 3 and 5 points respectively
             double q1 = h / 6.0  * (interval.f_left + 4.0 * interval.f_mid + interval.f_right);
             double q2 = h / 12.0 * (interval.f_left + 4.0 * fd + 2.0 * interval.f_mid + 4.0 * fe + interval.f_right);
 
-            if ((fabs(q2 - q1) < interval.tol) || ((interval.right - interval.left) < 1.0e-12)) {
+            if ((fabs(q2 - q1) < interval.tol) ||
+                unresolvable(interval.left, interval.right, interval.f_left, fd, interval.f_mid, fe,
+                             interval.f_right, q1, q2, integrand->noise)) {
                 // Note that each thread has its own local copy of quad because of reduction clause
                 // Tolerance is met, add to total
                 quad += q2 + (q2 - q1) / 15.0;
+
+                if (speculate)
+                    wasted += 4;
             } else {
                 // Tolerance is not met, split interval in two and add both halves to queue
                 struct Interval i1, i2;
@@ -208,6 +666,21 @@ double simpson(double (*func)(double), struct Queue *queues, int queues_size)
                 i2.f_mid   = fe;
                 i2.f_right = interval.f_right;
 
+                i1.error     = i2.error     = fabs(q2 - q1);
+                i1.evaluated = i2.evaluated = speculate;
+                if (speculate) {
+                    i1.f_d = fx[2];
+                    i1.f_e = fx[3];
+                    i2.f_d = fx[4];
+                    i2.f_e = fx[5];
+                } else {
+                    // Only the first two values were evaluated or reused
+                    i1.f_d = i1.f_e = i2.f_d = i2.f_e = 0.0;
+                }
+
+                i1.cost = cost_estimate(model, i1.left, i1.right);
+                i2.cost = cost_estimate(model, i2.left, i2.right);
+
                 // Add more intervals to be processed back to the top of the queue. 
                 // Ensure that only a single thread can enqueue at any point in time.
 
@@ -217,53 +690,163 @@ double simpson(double (*func)(double), struct Queue *queues, int queues_size)
 
                 omp_set_lock(&local_queue->lock);
                 {
-                    enqueue(i1, local_queue);
-                    enqueue(i2, local_queue);
+                    // The costlier half is pushed last and so processed
+                    // first
+                    if (i1.cost > i2.cost) {
+                        enqueue(i2, local_queue);
+                        enqueue(i1, local_queue);
+                    } else {
+                        enqueue(i1, local_queue);
+                        enqueue(i2, local_queue);
+                    }
+                    footprint_push(footprint, thread_id, size(local_queue));
                 }                
                 omp_unset_lock(&local_queue->lock);
+
+                // Unpark threads if there are now more intervals than
+                // threads polling for them
+                if (idle->mode == IDLE_PARK) {
+                    int waiting, busy;
+                    #pragma omp atomic capture
+                    waiting = queued += 2;
+                    #pragma omp atomic read
+                    busy = active_threads;
+
+                    idle_notify(idle, waiting, busy);
+                }
             }
 
             // Ensure that enqueuing or dequeuing does not try to modify 
-            // active_threads at the same time.
-            #pragma omp atomic
-            active_threads--;
+            // active_threads at the same time. When pushing, only once the
+            // local queue is empty, as no other thread can add to it.
+            STRESS_WORK_DONE();
+            if (!pushing || isempty(local_queue)) {
+                counted = false;
+                #pragma omp atomic
+                active_threads--;
+            }
 
         } // while
     } // parallel
 
+    if (idle == &local_idle)
+        idle_destroy(idle);
+
+    for (int i = 0; i < queues_size; ++i) {
+        assist_destroy(&slots[i]);
+    }
+
+    free(slots);
+    free(idle_bits);
+    free(mailboxes);
+
+    stats->evaluations += evaluations;
+    stats->speculated += speculated;
+    stats->wasted += wasted;
+    stats->pushes += batches;
+    stats->pushed += pushed;
+    stats->threads = team;
+
     return quad;
 }
 
-int main(void)
+bool balance_parse(bool *pushing)
 {
-    int thread_count = omp_get_max_threads();
-    printf("Threads: %d\n", thread_count);
+    const char *balance = getenv("SOLVER_BALANCE");
+
+    *pushing = (balance && strcmp(balance, "push") == 0);
+
+    return !balance || *pushing || strcmp(balance, "steal") == 0;
+}
+
+double integrate(const struct Integrand *integrand, double left, double right, double tol,
+                 struct SolverStats *stats)
+{
+    assert(integrand);
+
+    struct SolverStats local = { 0 };
+    if (!stats)
+        stats = &local;
+
+    stats->evaluations = 0;
+    stats->speculated = 0;
+    stats->wasted = 0;
+    stats->pushes = 0;
+    stats->pushed = 0;
+
+    // Speculate on intervals whose parent was further than this many times
+    // the tolerance from converging, 0 disables speculation
+    const char *factor = getenv("SOLVER_SPECULATE");
+    double speculation = factor ? atof(factor) : 0.0;
+
+    // Prefetching of queue entries is on unless SOLVER_PREFETCH=0
+    const char *prefetch = getenv("SOLVER_PREFETCH");
+
+    // Idle threads steal from other queues, or with SOLVER_BALANCE=push wait
+    // for threads with surplus work to push intervals to them. An invalid
+    // setting was already rejected by the caller.
+    bool pushing;
+    balance_parse(&pushing);
+
+    // An invalid SOLVER_IDLE was already rejected by the caller
+    enum IdleMode mode;
+    idle_mode_parse(&mode);
+
+    int thread_count = idle_team_size(mode, omp_get_max_threads());
 
     // Allocate a separate queue for each thread
     struct Queue *queues = (struct Queue *)malloc(sizeof(struct Queue) * thread_count);
+    if (!queues) {
+        printf("Failed to allocate queues - exiting\n");
+        exit(1);
+    }
 
     // Initiale queue for each thread
     for (int i = 0; i < thread_count; ++i) {
         initialize(&queues[i]);
     }
 
-    double start = omp_get_wtime();
+    if (stats->footprint) {
+        footprint_init(stats->footprint, thread_count, MAXQUEUE, sizeof(struct Interval));
+        footprint_alloc(stats->footprint, sizeof(struct Queue) * thread_count);
+    }
+
+    struct CostModel model;
+    cost_init(&model, integrand, left, right);
+
+    // Split the domain at the integrand's breakpoints, so that no interval
+    // has to be refined down to a jump, and deal the pieces out to the queues
+    struct Piece *pieces;
+    int count = integrand_pieces(integrand, left, right, &pieces);
+    stats->evaluations += 3 * count;
+
+    for (int i = 0; i < count; ++i) {
+        struct Interval piece;
+
+        piece.left    = pieces[i].left;
+        piece.right   = pieces[i].right;
+        piece.tol     = tol;
+        piece.f_left  = pieces[i].f_left;
+        piece.f_right = pieces[i].f_right;
+        piece.f_mid   = pieces[i].f_mid;
+        piece.error     = 0.0;
+        piece.evaluated = false;
+        piece.f_d = piece.f_e = 0.0;
+        piece.cost = cost_estimate(&model, piece.left, piece.right);
 
-    // Add initial interval to the queue
-    struct Interval whole;
-    whole.left    = 0.0;
-    whole.right   = 10.0;
-    whole.tol     = 1e-06;
-    whole.f_left  = func1(whole.left);
-    whole.f_right = func1(whole.right);
-    whole.f_mid   = func1((whole.left + whole.right) / 2.0);
+        enqueue(piece, &queues[i % thread_count]);
+    }
+
+    free(pieces);
 
-    enqueue(whole, &queues[0]);
+    for (int i = 0; i < thread_count; ++i) {
+        footprint_push(stats->footprint, i, size(&queues[i]));
+    }
 
     // Call queue-based quadrature routine
     // Pass array queues into simpson function so that threads can begin working
-    printf("Result = %e\n", simpson(func1, queues, thread_count));
-    printf("Time(s) = %f\n", omp_get_wtime() - start);
+    double quad = simpson(integrand, queues, thread_count, mode, speculation,
+                         !prefetch || atoi(prefetch) != 0, pushing, &model, stats);
 
     // Terminate queue for each thread.
     for (int i = 0; i < thread_count; ++i) {
@@ -271,4 +854,178 @@ int main(void)
     }
 
     free(queues);
+
+    return quad;
+}
+
+#ifndef SOLVER_LIBRARY
+// Integrate every "left right [tol]" line of a batch file, sharing function
+// evaluations between the integrals through a memo of budget_mb megabytes
+int batch(const struct Integrand *integrand, const char *path, double budget_mb)
+{
+    FILE *file = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+    if (!file) {
+        printf("Failed to open batch file %s - exiting\n", path);
+        exit(1);
+    }
+
+    struct Memo memo;
+    struct Integrand memoised = { memo_eval, &memo, integrand->breaks, integrand->nbreaks, NULL,
+                                  integrand->noise, NULL };
+    bool memoise = (budget_mb > 0.0);
+
+    if (memoise) {
+        memo_init(&memo, integrand, (size_t)(budget_mb * 1048576.0));
+        if (integrand->breakpoints)
+            memoised.breakpoints = memo_breakpoints;
+        if (integrand->cost)
+            memoised.cost = memo_cost;
+        integrand = &memoised;
+    }
+
+    printf("Threads: %d\n", omp_get_max_threads());
+
+    struct Energy energy;
+    long evaluations = 0;
+    int count = 0;
+    char line[256];
+
+    double start = omp_get_wtime();
+    energy_start(&energy);
+
+    while (fgets(line, sizeof(line), file)) {
+        double left, right, tol = 1e-06;
+
+        if (line[0] == '#' || sscanf(line, "%lf %lf %lf", &left, &right, &tol) < 2)
+            continue;
+
+        long hits = memoise ? memo.hits : 0;
+        long misses = memoise ? memo.misses : 0;
+
+        struct SolverStats stats = { 0 };
+        double quad = integrate(integrand, left, right, tol, &stats);
+        evaluations += stats.evaluations;
+
+        printf("Integral %d: [%g, %g] tol %g Result = %e", ++count, left, right, tol, quad);
+        if (memoise) {
+            hits = memo.hits - hits;
+            misses = memo.misses - misses;
+            printf(" Hit rate = %f", (hits + misses) > 0 ? (double)hits / (hits + misses) : 0.0);
+        }
+        printf("\n");
+    }
+
+    energy_stop(&energy);
+    double end = omp_get_wtime();
+
+    if (file != stdin)
+        fclose(file);
+
+    printf("Integrals = %d\n", count);
+    printf("Time(s) = %f\n", end - start);
+
+    // With a memo only misses are actual evaluations of the integrand
+    if (memoise) {
+        energy_report(&energy, count, memo.misses, stdout);
+        memo_report(&memo, stdout);
+        memo_destroy(&memo);
+    } else {
+        energy_report(&energy, count, evaluations, stdout);
+    }
+
+    // main has already checked SOLVER_COST
+    cost_report(cost_mode_from_env(integrand), stdout);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct Integrand integrand = { func1_batch, NULL, NULL, 0, NULL, FUNC1_NOISE, func1_cost_hook };
+
+    // Split the domain at the jumps of func1 with SOLVER_BREAKPOINTS=1. Off by
+    // default as the pieces alias with the sine, see the README.
+    const char *breakpoints = getenv("SOLVER_BREAKPOINTS");
+    if (breakpoints && atoi(breakpoints) != 0)
+        integrand.breakpoints = func1_breakpoints;
+
+    // An expression in SOLVER_EXPR replaces func1 without rebuilding
+    struct Expr expr;
+    bool expression = expr_from_env(&expr, &integrand);
+
+    // Checked here as integrate falls back to the default on a bad value
+    enum CostMode cost_mode = cost_mode_from_env(&integrand);
+    enum IdleMode idle_mode = idle_mode_from_env();
+
+    bool pushing;
+    if (!balance_parse(&pushing)) {
+        printf("Unknown SOLVER_BALANCE %s - exiting\n", getenv("SOLVER_BALANCE"));
+        exit(1);
+    }
+
+    // A batch of integrals: solver2_separate --batch file [memo MB]
+    if (argc > 2 && strcmp(argv[1], "--batch") == 0)
+        return batch(&integrand, argv[2], (argc > 3) ? atof(argv[3]) : 64.0);
+
+    // The domain and tolerance default to the coursework problem but can be
+    // overridden as: solver2_separate [left right [tol]]
+    double left  = (argc > 2) ? atof(argv[1]) : 0.0;
+    double right = (argc > 2) ? atof(argv[2]) : 10.0;
+    double tol   = (argc > 3) ? atof(argv[3]) : 1e-06;
+
+    printf("Threads: %d\n", omp_get_max_threads());
+    int team = idle_team_size(idle_mode, omp_get_max_threads());
+    if (team < omp_get_max_threads())
+        printf("Team limited to %d threads (requested %d)\n", team, omp_get_max_threads());
+    printf("Kernel variant: %s\n", kernel_variant());
+
+    struct SolverStats stats = { 0 };
+    struct Energy energy;
+    struct Footprint footprint;
+    struct Counters counters;
+    stats.footprint = &footprint;
+    stats.counters = &counters;
+    counters_init(&counters);
+
+    struct Idle idle;
+    stats.idle = &idle;
+
+    double start = omp_get_wtime();
+    energy_start(&energy);
+
+    double quad = integrate(&integrand, left, right, tol, &stats);
+
+    energy_stop(&energy);
+    double end = omp_get_wtime();
+
+    printf("Result = %e\n", quad);
+    printf("Time(s) = %f\n", end - start);
+    energy_report(&energy, 1, stats.evaluations, stdout);
+    idle_report(&idle, stdout);
+    idle_destroy(&idle);
+
+    // Only evaluations of intervals that split count towards the throughput
+    if (stats.speculated > 0) {
+        long useful = stats.evaluations - stats.wasted;
+
+        printf("Speculative evaluations = %ld\n", stats.speculated);
+        printf("Wasted evaluations = %ld\n", stats.wasted);
+        printf("Speculation hit rate = %f\n", 1.0 - (double)stats.wasted / stats.speculated);
+        printf("Useful evaluations/s = %f\n", useful / (end - start));
+    }
+
+    if (pushing) {
+        printf("Pushed batches = %ld\n", stats.pushes);
+        printf("Pushed intervals = %ld\n", stats.pushed);
+    }
+
+    cost_report(cost_mode, stdout);
+    counters_report(&counters, stats.evaluations, stdout);
+    footprint_report(&footprint, stdout);
+    footprint_json(&footprint, "solver2_separate", stats.threads, quad, end - start, stats.evaluations);
+    footprint_destroy(&footprint);
+
+    if (expression)
+        expr_destroy(&expr);
 }
+#endif
@@ -7,9 +7,22 @@
 #include <omp.h>
 
 #include "function.h"
+#include "refine.h"
+#include "assist.h"
+#include "idle.h"
+#include "energy.h"
+#include "solver.h"
+#include "footprint.h"
+#include "stress.h"
+#include "cost.h"
+#include "expr.h"
 
 #define MAXQUEUE 10000
 
+// Polls of its own request slot after which a combining thread blocks on the
+// queue lock, in case the lock holder has lost its core
+#define COMBINE_POLLS 64
+
 struct Interval {
     double left;    // left boundary
     double right;   // right boundary
@@ -24,6 +37,7 @@ struct Queue {
     int16_t top;                     // index of last entry
 
     omp_lock_t lock;                 // Queue lock
+    int combining;                   // set while a thread combines under the lock
 };
 
 // add an interval to the queue
@@ -58,6 +72,7 @@ struct Interval dequeue(struct Queue *queue_p)
 void initialize(struct Queue *queue_p)
 {
     queue_p->top = -1;
+    queue_p->combining = 0;
     omp_init_lock(&queue_p->lock);
 }
 
@@ -82,66 +97,340 @@ int size(struct Queue *queue_p)
     return (queue_p->top + 1);
 }
 
-double simpson(double (*func)(double), struct Queue *queue_p)
+// Operations a thread can publish for flat combining
+enum RequestOp {
+    REQUEST_NONE, // no request, or the last one has been served
+    REQUEST_TAKE, // take an interval
+    REQUEST_PUT   // queue the halves of a split interval
+};
+
+// Request slot owned by a single thread. With flat combining a thread
+// publishes its queue operation here, and whichever thread holds the queue
+// lock serves every published request in one pass.
+struct Request {
+    int op;                      // REQUEST_NONE once served
+    struct Interval interval[2]; // halves to queue, or the interval taken
+    int count;                   // intervals to queue, or 1 if one was taken
+    bool done;                   // served take: queue empty and no thread active
+    int waiting;                 // queued intervals after the pass
+};
+
+// Counts of the combining passes
+struct Combining {
+    long passes;     // passes made by a lock holder
+    long requests;   // requests served by the passes
+    long eliminated; // intervals handed from a put to a take without the queue
+};
+
+// Serve every published request while holding the queue lock. Puts are
+// paired with takes first. A take is given the last interval of a put,
+// which is what the LIFO queue would have returned had the put gone first,
+// so the result is the same as applying the puts and then the takes.
+static void combine(struct Request *requests, int count, struct Queue *queue_p, int *active_threads,
+                    struct Footprint *footprint, struct Combining *stats)
 {
-    assert(func && queue_p);
+    // Only requests published before this point are served
+    int op[count];
+    bool taken[count];
+    int served = 0;
+    bool put = false;
+
+    for (int i = 0; i < count; ++i) {
+        #pragma omp atomic read
+        op[i] = requests[i].op;
+        taken[i] = false;
+    }
+    #pragma omp flush
+
+    int take = 0;
+    for (int i = 0; i < count; ++i) {
+        if (op[i] != REQUEST_PUT)
+            continue;
+
+        struct Request *request = &requests[i];
+
+        // Hand the top intervals to waiting takes, queue the rest
+        while (request->count > 0) {
+            while (take < count && op[take] != REQUEST_TAKE)
+                take++;
+            if (take == count)
+                break;
+
+            requests[take].interval[0] = request->interval[--request->count];
+            requests[take].count = 1;
+            taken[take++] = true;
+            stats->eliminated++;
+            STRESS_DELAY(STRESS_DEQUEUE);
+
+            #pragma omp atomic
+            (*active_threads)++;
+        }
+
+        for (int k = 0; k < request->count; ++k) {
+            enqueue(request->interval[k], queue_p);
+        }
+        put = true;
+    }
+
+    // Takes left over are served from the queue
+    for (int i = take; i < count; ++i) {
+        if (op[i] != REQUEST_TAKE)
+            continue;
+
+        requests[i].count = 0;
+        if (!isempty(queue_p)) {
+            requests[i].interval[0] = dequeue(queue_p);
+            requests[i].count = 1;
+            STRESS_DELAY(STRESS_DEQUEUE);
+
+            #pragma omp atomic
+            (*active_threads)++;
+        }
+    }
+
+    if (put)
+        footprint_push(footprint, 0, size(queue_p));
+
+    bool done = (isempty(queue_p) && *active_threads == 0);
+    int waiting = size(queue_p);
+
+    // Release the requesting threads
+    for (int i = 0; i < count; ++i) {
+        if (op[i] == REQUEST_NONE)
+            continue;
+
+        requests[i].done = done && !taken[i];
+        requests[i].waiting = waiting;
+        served++;
+
+        #pragma omp flush
+        #pragma omp atomic write
+        requests[i].op = REQUEST_NONE;
+    }
+
+    stats->passes++;
+    stats->requests += served;
+}
+
+// Publish a request and wait until it has been served. The thread polls its
+// own slot and only tries the queue lock when no combiner appears to hold it,
+// so waiting adds no traffic on the lock. If nobody serves the request for a
+// while it blocks on the lock and serves it itself.
+static void submit(enum RequestOp op, struct Request *requests, int count, int self, struct Queue *queue_p,
+                   int *active_threads, struct Idle *idle, struct Footprint *footprint, struct Combining *stats)
+{
+    #pragma omp flush
+    #pragma omp atomic write
+    requests[self].op = (int)op;
+
+    for (int polls = 0; ; ++polls) {
+        int pending;
+        #pragma omp atomic read
+        pending = requests[self].op;
+
+        if (pending == REQUEST_NONE)
+            break;
+
+        int held;
+        #pragma omp atomic read
+        held = queue_p->combining;
+
+        if (polls >= COMBINE_POLLS)
+            omp_set_lock(&queue_p->lock);
+        else if (held || !omp_test_lock(&queue_p->lock)) {
+            idle_pause(idle);
+            continue;
+        }
+
+        #pragma omp atomic write
+        queue_p->combining = 1;
+
+        combine(requests, count, queue_p, active_threads, footprint, stats);
+
+        #pragma omp atomic write
+        queue_p->combining = 0;
+
+        omp_unset_lock(&queue_p->lock);
+        polls = 0;
+    }
+    #pragma omp flush
+}
+
+double simpson(const struct Integrand *integrand, struct Queue *queue_p, struct CostModel *model,
+               struct SolverStats *stats)
+{
+    assert(integrand && queue_p && stats);
 
     double quad = 0.0;
+    long evaluations = 0;
+    int team = 0;
 
     // Keeps track of number of threads currently processing intervals so that 
     // we only terminate if both the queue is empty and no threads are 
     // processing.
     int active_threads = 0;
 
-#pragma omp parallel default(none) shared(func, queue_p, active_threads) reduction(+: quad)
+    // Help slots through which threads share the evaluation of an interval
+    // with idle threads once there are too few intervals to go around.
+    // An invalid SOLVER_IDLE was already rejected by the caller
+    enum IdleMode mode;
+    idle_mode_parse(&mode);
+
+    int thread_count = idle_team_size(mode, omp_get_max_threads());
+    struct Assist *slots = (struct Assist *)malloc(sizeof(struct Assist) * thread_count);
+    if (!slots) {
+        printf("Failed to allocate help slots - exiting\n");
+        exit(1);
+    }
+
+    struct Footprint *footprint = stats->footprint;
+    footprint_alloc(footprint, sizeof(struct Assist) * thread_count);
+
+    struct Counters *counters = stats->counters;
+
+    for (int i = 0; i < thread_count; ++i) {
+        assist_init(&slots[i]);
+    }
+
+    // Threads without work may park while there are too few queued intervals.
+    // The idle state is kept in the caller's if it wants to report it.
+    struct Idle local_idle;
+    struct Idle *idle = stats->idle ? stats->idle : &local_idle;
+    idle_init(idle, thread_count, mode);
+
+    // Offering work to helpers that may not get a core only makes the owner wait
+    bool sharing = (assist_enabled() && idle->mode != IDLE_YIELD && idle->mode != IDLE_AUTO);
+
+    // With SOLVER_COMBINE=1 threads publish their queue operations and the
+    // lock holder serves them all at once
+    const char *setting = getenv("SOLVER_COMBINE");
+    bool combining = (setting && atoi(setting) != 0);
+
+    struct Request *requests = (struct Request *)malloc(sizeof(struct Request) * thread_count);
+    if (!requests) {
+        printf("Failed to allocate request slots - exiting\n");
+        exit(1);
+    }
+    footprint_alloc(footprint, sizeof(struct Request) * thread_count);
+
+    for (int i = 0; i < thread_count; ++i) {
+        requests[i].op = REQUEST_NONE;
+    }
+
+    struct Combining combined = { 0 };
+
+#pragma omp parallel num_threads(thread_count) default(none) shared(integrand, queue_p, active_threads, slots, thread_count, idle, sharing, footprint, counters, model, combining, requests, combined, team) reduction(+: quad, evaluations)
 {
+    int thread_id = omp_get_thread_num();
+
+    // Record the size of the team actually started
+    if (thread_id == 0)
+        team = omp_get_num_threads();
+
+    int events[COUNTERS_EVENTS];
+    counters_thread_start(counters, events);
+
     // Already have function values at left and right boundaries and midpoint
-    // Now evaluate function at one-qurter and three-quarter points
-    struct Interval interval;
+    // Now evaluate function at one-qurter and three-quarter points. Only read
+    // after a successful take, initialised as the compiler can not tell.
+    struct Interval interval = { 0 };
 
     // Termination criteria must now be satisfied from within the loop
     while (1) {
         bool work = false, done = false;
+        int waiting;
+
+        // Any thread that finds a sample due counts the queued intervals
+        if (footprint_claim(footprint))
+            footprint_sample(footprint, size(queue_p));
 
         // Only dequeue an interval from the queue if the queue is not 
         // empty. Then set work status as true and update active thread
         // count.
-        omp_set_lock(&queue_p->lock);
-        {
-            if (!isempty(queue_p)) {
-                interval = dequeue(queue_p);
-                work = true;
-
-                // Ensure that enqueuing or dequeuing does not try to modify 
-                // active_threads at the same time.
-                #pragma omp atomic
-                active_threads++;
+        if (combining) {
+            struct Request *request = &requests[thread_id];
+
+            submit(REQUEST_TAKE, requests, thread_count, thread_id, queue_p, &active_threads, idle, footprint,
+                   &combined);
+            work = (request->count == 1);
+            if (work)
+                interval = request->interval[0];
+            done = request->done;
+            waiting = request->waiting;
+        } else {
+            omp_set_lock(&queue_p->lock);
+            {
+                if (!isempty(queue_p)) {
+                    interval = dequeue(queue_p);
+                    work = true;
+                    STRESS_DELAY(STRESS_DEQUEUE);
+
+                    // Ensure that enqueuing or dequeuing does not try to modify 
+                    // active_threads at the same time.
+                    #pragma omp atomic
+                    active_threads++;
+                }
+                done = (isempty(queue_p) && active_threads == 0);
+                waiting = size(queue_p);
             }
-            done = (isempty(queue_p) && active_threads == 0);
+            omp_unset_lock(&queue_p->lock);
         }
-        omp_unset_lock(&queue_p->lock);
     
         // Checking if a queue is empty is not enough as other threads 
         // might be currently processing intervals. Only terminate if
         // both the queue is empty and no threads are executing.
-        if (done)
+        STRESS_DELAY(STRESS_TERMINATE);
+        if (done) {
+            STRESS_EXIT();
+            idle_stop(idle);
+            counters_thread_stop(counters, events);
             break;
+        }
+
+        // Help evaluate another thread's interval while waiting for work, or
+        // park if there is nothing to help with
+        if (!work) {
+            if (!assist_help(slots, thread_count, thread_id)) {
+                int busy;
+                #pragma omp atomic read
+                busy = active_threads;
 
-        if (!work)
+                idle_wait(idle, waiting, busy);
+            }
             continue;
+        }
 
         double h  = interval.right - interval.left;
         double c  = (interval.left + interval.right) / 2.0;
         double d  = (interval.left + c) / 2.0;
         double e  = (c + interval.right) / 2.0;
-        double fd = func(d);
-        double fe = func(e);
+
+        // Both points are handed to the integrand in a single batch. If there
+        // are fewer queued intervals than idle threads, offer one of the
+        // points to an idle thread.
+        int busy;
+        #pragma omp atomic read
+        busy = active_threads;
+
+        bool share = (sharing && size(queue_p) < thread_count - busy);
+
+        double x[2] = { d, e };
+        double fx[2];
+        double timed = (model->mode == COST_LEARNED) ? omp_get_wtime() : 0.0;
+        assist_eval(&slots[thread_id], idle, integrand, x, fx, 2, share);
+        if (model->mode == COST_LEARNED)
+            cost_record(model, c, 2, omp_get_wtime() - timed);
+        evaluations += 2;
+        double fd = fx[0];
+        double fe = fx[1];
 
         // Calculate integral estimates using 3 and 5 points respectively
         double q1 = h / 6.0 * (interval.f_left + 4.0 * interval.f_mid + interval.f_right);
         double q2 = h / 12.0 * (interval.f_left + 4.0 * fd + 2.0 * interval.f_mid + 4.0 * fe + interval.f_right);
 
-        if ((fabs(q2 - q1) < interval.tol) || ((interval.right - interval.left) < 1.0e-12)) {
+        if ((fabs(q2 - q1) < interval.tol) ||
+            unresolvable(interval.left, interval.right, interval.f_left, fd, interval.f_mid, fe,
+                         interval.f_right, q1, q2, integrand->noise)) {
             // Note that each thread has its own local copy of quad because of reduction clause
             // Tolerance is met, add to total
             quad += q2 + (q2 - q1) / 15.0;
@@ -165,49 +454,181 @@ double simpson(double (*func)(double), struct Queue *queue_p)
 
             // Add more intervals to be processed back to the top of the queue. 
             // Ensure that only a single thread can enqueue at any point in time.
-            omp_set_lock(&queue_p->lock);
-            enqueue(i1, queue_p);
-            enqueue(i2, queue_p);
-            omp_unset_lock(&queue_p->lock);
+            // With a cost model the costlier half is pushed last and so
+            // processed first
+            bool swap = (cost_estimate(model, i1.left, i1.right) > cost_estimate(model, i2.left, i2.right));
+
+            if (combining) {
+                struct Request *request = &requests[thread_id];
+
+                request->interval[0] = swap ? i2 : i1;
+                request->interval[1] = swap ? i1 : i2;
+                request->count = 2;
+                submit(REQUEST_PUT, requests, thread_count, thread_id, queue_p, &active_threads, idle, footprint,
+                       &combined);
+                waiting = request->waiting;
+            } else {
+                omp_set_lock(&queue_p->lock);
+                enqueue(swap ? i2 : i1, queue_p);
+                enqueue(swap ? i1 : i2, queue_p);
+                waiting = size(queue_p);
+                footprint_push(footprint, 0, waiting);
+                omp_unset_lock(&queue_p->lock);
+            }
+
+            // Unpark threads if there are now more intervals than threads
+            // polling for them
+            int busy;
+            #pragma omp atomic read
+            busy = active_threads;
+
+            idle_notify(idle, waiting, busy);
         }
 
         // Ensure that enqueuing or dequeuing does not try to modify 
         // active_threads at the same time.
+        STRESS_WORK_DONE();
         #pragma omp atomic
         active_threads--;
-        
+
     } // while
     
 } // #pragma omp parallel
 
+    if (idle == &local_idle)
+        idle_destroy(idle);
+    free(requests);
+
+    for (int i = 0; i < thread_count; ++i) {
+        assist_destroy(&slots[i]);
+    }
+
+    free(slots);
+
+    stats->evaluations += evaluations;
+    stats->passes += combined.passes;
+    stats->combined += combined.requests;
+    stats->eliminated += combined.eliminated;
+    stats->threads = team;
+
     return quad;
 }
 
-int main(void)
+double integrate(const struct Integrand *integrand, double left, double right, double tol,
+                 struct SolverStats *stats)
 {
+    assert(integrand);
+
+    struct SolverStats local = { 0 };
+    if (!stats)
+        stats = &local;
+
     struct Queue queue;
-    struct Interval whole;
+    struct Interval piece;
 
     // Initialise queue
     initialize(&queue);
 
-    double start = omp_get_wtime();
-
-    printf("Threads: %d\n", omp_get_max_threads());
+    if (stats->footprint) {
+        footprint_init(stats->footprint, 1, MAXQUEUE, sizeof(struct Interval));
+        footprint_alloc(stats->footprint, sizeof(struct Queue));
+    }
 
-    // Add initial interval to the queue
-    whole.left    = 0.0;
-    whole.right   = 10.0;
-    whole.tol     = 1e-06;
-    whole.f_left  = func1(whole.left);
-    whole.f_right = func1(whole.right);
-    whole.f_mid   = func1((whole.left + whole.right) / 2.0);
+    struct CostModel model;
+    cost_init(&model, integrand, left, right);
+
+    // Split the domain at the integrand's breakpoints, so that no interval
+    // has to be refined down to a jump, and queue the pieces
+    struct Piece *pieces;
+    int count = integrand_pieces(integrand, left, right, &pieces);
+    stats->evaluations = 3 * count;
+    stats->speculated = 0;
+    stats->wasted = 0;
+
+    for (int i = 0; i < count; ++i) {
+        piece.left    = pieces[i].left;
+        piece.right   = pieces[i].right;
+        piece.tol     = tol;
+        piece.f_left  = pieces[i].f_left;
+        piece.f_right = pieces[i].f_right;
+        piece.f_mid   = pieces[i].f_mid;
+
+        enqueue(piece, &queue);
+    }
 
-    enqueue(whole, &queue);
+    free(pieces);
+    footprint_push(stats->footprint, 0, size(&queue));
 
     // Call queue-based quadrature routine
-    printf("Result = %e\n", simpson(func1, &queue));
-    printf("Time(s) = %f\n", omp_get_wtime() - start);
+    double quad = simpson(integrand, &queue, &model, stats);
 
     terminate(&queue);
+
+    return quad;
+}
+
+#ifndef SOLVER_LIBRARY
+int main(void)
+{
+    struct Integrand integrand = { func1_batch, NULL, NULL, 0, NULL, FUNC1_NOISE, func1_cost_hook };
+    struct SolverStats stats = { 0 };
+
+    // Split the domain at the jumps of func1 with SOLVER_BREAKPOINTS=1. Off by
+    // default as the pieces alias with the sine, see the README.
+    const char *breakpoints = getenv("SOLVER_BREAKPOINTS");
+    if (breakpoints && atoi(breakpoints) != 0)
+        integrand.breakpoints = func1_breakpoints;
+
+    // An expression in SOLVER_EXPR replaces func1 without rebuilding
+    struct Expr expr;
+    bool expression = expr_from_env(&expr, &integrand);
+
+    // Checked here as integrate falls back to the default on a bad value
+    enum CostMode cost_mode = cost_mode_from_env(&integrand);
+    enum IdleMode idle_mode = idle_mode_from_env();
+    struct Energy energy;
+    struct Footprint footprint;
+    struct Counters counters;
+    stats.footprint = &footprint;
+    stats.counters = &counters;
+    counters_init(&counters);
+
+    struct Idle idle;
+    stats.idle = &idle;
+
+    double start = omp_get_wtime();
+    energy_start(&energy);
+
+    printf("Threads: %d\n", omp_get_max_threads());
+    int team = idle_team_size(idle_mode, omp_get_max_threads());
+    if (team < omp_get_max_threads())
+        printf("Team limited to %d threads (requested %d)\n", team, omp_get_max_threads());
+    printf("Kernel variant: %s\n", kernel_variant());
+
+    double quad = integrate(&integrand, 0.0, 10.0, 1e-06, &stats);
+
+    energy_stop(&energy);
+    double end = omp_get_wtime();
+
+    printf("Result = %e\n", quad);
+    printf("Time(s) = %f\n", end - start);
+    energy_report(&energy, 1, stats.evaluations, stdout);
+    idle_report(&idle, stdout);
+    idle_destroy(&idle);
+
+    if (stats.passes > 0) {
+        printf("Combining passes = %ld\n", stats.passes);
+        printf("Requests per pass = %f\n", (double)stats.combined / stats.passes);
+        printf("Eliminated intervals = %ld\n", stats.eliminated);
+    }
+
+    cost_report(cost_mode, stdout);
+    counters_report(&counters, stats.evaluations, stdout);
+    footprint_report(&footprint, stdout);
+    footprint_json(&footprint, "solver2_shared", stats.threads, quad, end - start, stats.evaluations);
+    footprint_destroy(&footprint);
+
+    if (expression)
+        expr_destroy(&expr);
 }
+#endif
@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <omp.h>
+
+#include "function.h"
+#include "refine.h"
+#include "energy.h"
+
+#define MAXQUEUE 10000
+
+// Interval of the union mesh of all variants. Each lane holds the function
+// values of one variant, and mask marks the variants that still need the
+// interval refined.
+struct Interval {
+    double left;                      // left boundary
+    double right;                     // right boundary
+    double tol;                       // tolerance
+    unsigned mask;                    // variants not yet accepted
+    double f_left[SWEEP_MAXLANES];    // function values at left boundary
+    double f_mid[SWEEP_MAXLANES];     // function values at midpoint
+    double f_right[SWEEP_MAXLANES];   // function values at right boundary
+};
+
+struct Queue {
+    struct Interval entry[MAXQUEUE]; // array of queue entries
+    int16_t top;                     // index of last entry
+    omp_lock_t lock;                 // Queue lock
+};
+
+// add an interval to the queue
+void enqueue(struct Interval *interval, struct Queue *queue_p)
+{
+    if (queue_p->top == MAXQUEUE - 1) {
+        printf("Maximum queue size exceeded - exiting\n");
+        exit(1);
+    }
+
+    queue_p->top++;
+
+    queue_p->entry[queue_p->top] = *interval;
+}
+
+// extract last interval from queue
+void dequeue(struct Queue *queue_p, struct Interval *interval)
+{
+    if (queue_p->top == -1) {
+        printf("Attempt to extract from empty queue - exiting\n");
+        exit(1);
+    }
+
+    *interval = queue_p->entry[queue_p->top];
+
+    queue_p->top--;
+}
+
+// initialise queue
+void initialize(struct Queue *queue_p)
+{
+    queue_p->top = -1;
+    omp_init_lock(&queue_p->lock);
+}
+
+// terminate queue
+void terminate(struct Queue *queue_p)
+{
+    omp_destroy_lock(&queue_p->lock);
+    queue_p->top = -1;
+}
+
+// return whether queue is empty
+int isempty(struct Queue *queue_p)
+{
+    int result = (queue_p->top == -1);
+
+    return result;
+}
+
+// 3 and 5 point estimates of the first lanes of an interval, built for
+// several instruction sets like the sweep's Euler kernel
+KERNEL_CLONES
+void estimates(const struct Interval *interval, const double *fd, const double *fe, int lanes, double *q1,
+               double *q2)
+{
+    double h = interval->right - interval->left;
+
+#pragma omp simd
+    for (int k = 0; k < lanes; ++k) {
+        q1[k] = h / 6.0  * (interval->f_left[k] + 4.0 * interval->f_mid[k] + interval->f_right[k]);
+        q2[k] = h / 12.0 * (interval->f_left[k] + 4.0 * fd[k] + 2.0 * interval->f_mid[k] + 4.0 * fe[k] + interval->f_right[k]);
+    }
+}
+
+// Integrate every variant of the sweep at once. Intervals are refined while
+// any variant needs it, and each variant accepts an interval on its own, so
+// every variant gets the same result as if it was integrated alone while the
+// scheduling cost is shared between them. quad receives one result per lane.
+void simpson(const struct Func1Sweep *sweep, struct Queue *queues, int queues_size,
+             double *quad, long *evaluations)
+{
+    assert(sweep && queues && quad);
+
+    int active_threads = 0;
+    int lanes = sweep->lanes;
+
+    for (int k = 0; k < lanes; ++k) {
+        quad[k] = 0.0;
+    }
+
+    #pragma omp parallel default(none) shared(sweep, queues, active_threads, queues_size, quad, lanes, evaluations)
+    {
+        int thread_id = omp_get_thread_num();
+        struct Queue *local_queue = &queues[thread_id];
+
+        double local_quad[SWEEP_MAXLANES] = { 0.0 };
+        long local_evaluations = 0;
+
+        // Intervals are large, so keep the current one and its children
+        // outside of the loop
+        struct Interval interval, i1, i2;
+
+        while (1) {
+            bool thread_has_work = false;
+
+            omp_set_lock(&local_queue->lock);
+            {
+                if (!isempty(local_queue)) {
+                    dequeue(local_queue, &interval);
+                    thread_has_work = true;
+
+                    #pragma omp atomic
+                    active_threads++;
+                }
+            }
+            omp_unset_lock(&local_queue->lock);
+
+            if (!thread_has_work) {
+                // Attempt to steal work in a round robin fashion relative
+                // from the current thread.
+                for (int attempt = 1; attempt < queues_size && !thread_has_work; ++attempt) {
+                    struct Queue *other_queue = &queues[(thread_id + attempt) % queues_size];
+
+                    if (omp_test_lock(&other_queue->lock)) {
+                        if (!isempty(other_queue)) {
+                            dequeue(other_queue, &interval);
+                            thread_has_work = true;
+
+                            #pragma omp atomic
+                            active_threads++;
+                        }
+                        omp_unset_lock(&other_queue->lock);
+                    }
+                }
+            }
+
+            // Only terminate if both the queue is empty and no threads are
+            // executing.
+            bool terminate = (isempty(local_queue) && active_threads == 0);
+            if (terminate) {
+                break;
+            }
+
+            if (!thread_has_work) {
+                continue;
+            }
+
+            double c = (interval.left + interval.right) / 2.0;
+            double d = (interval.left + c) / 2.0;
+            double e = (c + interval.right) / 2.0;
+
+            // One evaluation per point covers all variants still refining
+            double fd[SWEEP_MAXLANES], fe[SWEEP_MAXLANES];
+            func1_sweep(d, sweep, interval.mask, fd);
+            func1_sweep(e, sweep, interval.mask, fe);
+            local_evaluations += 2;
+
+            unsigned refine = 0;
+
+            double q1[SWEEP_MAXLANES], q2[SWEEP_MAXLANES];
+            estimates(&interval, fd, fe, lanes, q1, q2);
+
+            for (int k = 0; k < lanes; ++k) {
+                if (!(interval.mask & (1u << k)))
+                    continue;
+
+                if ((fabs(q2[k] - q1[k]) < interval.tol) ||
+                    unresolvable(interval.left, interval.right, interval.f_left[k], fd[k], interval.f_mid[k], fe[k],
+                                 interval.f_right[k], q1[k], q2[k], 0.0)) {
+                    // Tolerance is met for this variant, add to its total
+                    local_quad[k] += q2[k] + (q2[k] - q1[k]) / 15.0;
+                } else {
+                    refine |= 1u << k;
+                }
+            }
+
+            if (refine) {
+                // Tolerance is not met for some variants, split interval in two
+                // and add both halves to the queue for those variants
+                i1.left  = interval.left;
+                i1.right = c;
+                i1.tol   = interval.tol;
+                i1.mask  = refine;
+
+                i2.left  = c;
+                i2.right = interval.right;
+                i2.tol   = interval.tol;
+                i2.mask  = refine;
+
+                for (int k = 0; k < lanes; ++k) {
+                    i1.f_left[k]  = interval.f_left[k];
+                    i1.f_mid[k]   = fd[k];
+                    i1.f_right[k] = interval.f_mid[k];
+
+                    i2.f_left[k]  = interval.f_mid[k];
+                    i2.f_mid[k]   = fe[k];
+                    i2.f_right[k] = interval.f_right[k];
+                }
+
+                omp_set_lock(&local_queue->lock);
+                {
+                    enqueue(&i1, local_queue);
+                    enqueue(&i2, local_queue);
+                }
+                omp_unset_lock(&local_queue->lock);
+            }
+
+            #pragma omp atomic
+            active_threads--;
+
+        } // while
+
+        for (int k = 0; k < lanes; ++k) {
+            #pragma omp atomic
+            quad[k] += local_quad[k];
+        }
+
+        #pragma omp atomic
+        *evaluations += local_evaluations;
+    } // parallel
+}
+
+// Read "amplitude frequency density step" lines into the sweep
+void read_sweep(const char *path, struct Func1Sweep *sweep)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        printf("Failed to open sweep file %s - exiting\n", path);
+        exit(1);
+    }
+
+    char line[256];
+    sweep->lanes = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        double amplitude, frequency, density, step;
+
+        if (line[0] == '#' || sscanf(line, "%lf %lf %lf %lf", &amplitude, &frequency, &density, &step) != 4)
+            continue;
+
+        if (sweep->lanes == SWEEP_MAXLANES) {
+            printf("At most %d variants can be swept at once - exiting\n", SWEEP_MAXLANES);
+            exit(1);
+        }
+
+        sweep->amplitude[sweep->lanes] = amplitude;
+        sweep->frequency[sweep->lanes] = frequency;
+        sweep->density[sweep->lanes]   = density;
+        sweep->step[sweep->lanes]      = step;
+        sweep->lanes++;
+    }
+
+    fclose(file);
+
+    if (sweep->lanes == 0) {
+        printf("No variants in sweep file %s - exiting\n", path);
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct Func1Sweep sweep;
+    memset(&sweep, 0, sizeof(sweep));
+
+    // Variants are read from: solver2_sweep [file]. By default the Euler step
+    // density is swept around the coursework value.
+    if (argc > 1) {
+        read_sweep(argv[1], &sweep);
+    } else {
+        sweep.lanes = 8;
+        for (int k = 0; k < sweep.lanes; ++k) {
+            sweep.amplitude[k] = 100000.0;
+            sweep.frequency[k] = 100000.0;
+            sweep.density[k]   = 200.0 * (k + 1) / 4.0;
+            sweep.step[k]      = 0.0001;
+        }
+    }
+
+    int thread_count = omp_get_max_threads();
+    printf("Threads: %d\n", thread_count);
+    printf("Kernel variant: %s\n", kernel_variant());
+    printf("Variants: %d\n", sweep.lanes);
+
+    struct Queue *queues = (struct Queue *)malloc(sizeof(struct Queue) * thread_count);
+    if (!queues) {
+        printf("Failed to allocate queues - exiting\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < thread_count; ++i) {
+        initialize(&queues[i]);
+    }
+
+    struct Energy energy;
+    double quad[SWEEP_MAXLANES];
+    long evaluations = 3;
+
+    double start = omp_get_wtime();
+    energy_start(&energy);
+
+    // Add initial interval to the queue with all variants refining
+    struct Interval whole;
+    whole.left  = 0.0;
+    whole.right = 10.0;
+    whole.tol   = 1e-06;
+    whole.mask  = (1u << sweep.lanes) - 1;
+    func1_sweep(whole.left, &sweep, whole.mask, whole.f_left);
+    func1_sweep(whole.right, &sweep, whole.mask, whole.f_right);
+    func1_sweep((whole.left + whole.right) / 2.0, &sweep, whole.mask, whole.f_mid);
+
+    enqueue(&whole, &queues[0]);
+
+    simpson(&sweep, queues, thread_count, quad, &evaluations);
+
+    energy_stop(&energy);
+    double end = omp_get_wtime();
+
+    for (int k = 0; k < sweep.lanes; ++k) {
+        printf("Variant %d: amplitude %g frequency %g density %g step %g Result = %e\n", k,
+               sweep.amplitude[k], sweep.frequency[k], sweep.density[k], sweep.step[k], quad[k]);
+    }
+    printf("Time(s) = %f\n", end - start);
+
+    // Each evaluation of the union mesh covers every variant still refining
+    energy_report(&energy, sweep.lanes, evaluations, stdout);
+
+    for (int i = 0; i < thread_count; ++i) {
+        terminate(&queues[i]);
+    }
+
+    free(queues);
+}
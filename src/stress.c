@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "stress.h"
+
+static double probability = 0.0;
+static double max_delay = 0.0;
+
+// Time each thread last finished an interval and left the solver loop
+static double work_done[STRESS_MAXTHREADS];
+static double exited[STRESS_MAXTHREADS];
+
+static long delays[STRESS_POINTS];
+
+// Per thread generator so that threads delay independently
+static uint64_t state = 0;
+#pragma omp threadprivate(state)
+
+static double uniform(void)
+{
+    if (state == 0)
+        state = 0x9e3779b97f4a7c15ULL * (omp_get_thread_num() + 1);
+
+    // xorshift64*
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+
+    return ((state * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void stress_configure(double p, double delay)
+{
+    probability = p;
+    max_delay = delay;
+}
+
+void stress_delay(enum StressPoint point)
+{
+    assert(point < STRESS_POINTS);
+
+    if (probability <= 0.0 || uniform() >= probability)
+        return;
+
+    #pragma omp atomic
+    delays[point]++;
+
+    // Spin rather than sleep, the delay stands in for a preempted or slow
+    // thread and must not give up the core
+    double until = omp_get_wtime() + max_delay * uniform();
+    while (omp_get_wtime() < until)
+        ;
+}
+
+void stress_work_done(void)
+{
+    int thread_id = omp_get_thread_num();
+    if (thread_id < STRESS_MAXTHREADS)
+        work_done[thread_id] = omp_get_wtime();
+}
+
+void stress_exit(void)
+{
+    int thread_id = omp_get_thread_num();
+    if (thread_id < STRESS_MAXTHREADS)
+        exited[thread_id] = omp_get_wtime();
+}
+
+void stress_reset(void)
+{
+    for (int i = 0; i < STRESS_MAXTHREADS; ++i) {
+        work_done[i] = 0.0;
+        exited[i] = 0.0;
+    }
+}
+
+void stress_collect(double *latency, int *early)
+{
+    double last_work = 0.0, last_exit = 0.0;
+
+    for (int i = 0; i < STRESS_MAXTHREADS; ++i) {
+        if (work_done[i] > last_work)
+            last_work = work_done[i];
+        if (exited[i] > last_exit)
+            last_exit = exited[i];
+    }
+
+    *early = 0;
+    for (int i = 0; i < STRESS_MAXTHREADS; ++i) {
+        if (exited[i] > 0.0 && exited[i] < last_work)
+            (*early)++;
+    }
+
+    *latency = last_exit - last_work;
+}
+
+long stress_delays(enum StressPoint point)
+{
+    return delays[point];
+}
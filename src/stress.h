@@ -0,0 +1,52 @@
+#ifndef STRESS_H
+#define STRESS_H
+
+// Points of the queue solvers' scheduling protocol where the stress harness
+// injects random delays
+enum StressPoint {
+    STRESS_DEQUEUE,   // between taking an interval and counting it as active
+    STRESS_STEAL,     // the same for an interval stolen from another queue
+    STRESS_TERMINATE, // before checking the termination condition
+    STRESS_POINTS
+};
+
+// Most threads whose exit is timed
+#define STRESS_MAXTHREADS 256
+
+#ifdef SOLVER_STRESS
+
+// Delay the calling thread with the configured probability
+void stress_delay(enum StressPoint);
+
+// The calling thread finished an interval, or left the solver loop
+void stress_work_done(void);
+void stress_exit(void);
+
+#define STRESS_DELAY(point) stress_delay(point)
+#define STRESS_WORK_DONE()  stress_work_done()
+#define STRESS_EXIT()       stress_exit()
+
+#else
+
+#define STRESS_DELAY(point)
+#define STRESS_WORK_DONE()
+#define STRESS_EXIT()
+
+#endif
+
+// Delays are taken with the given probability at each point and last up to
+// max_delay seconds
+void stress_configure(double probability, double max_delay);
+
+// Clear the timings before a run
+void stress_reset(void);
+
+// Timings of the last run. latency is the time from the end of the last
+// interval until the last thread left, early the number of threads that left
+// while another thread was still working on an interval.
+void stress_collect(double *latency, int *early);
+
+// Delays taken since the harness started
+long stress_delays(enum StressPoint);
+
+#endif
@@ -0,0 +1,193 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <omp.h>
+
+#include "function.h"
+#include "refine.h"
+#include "solver.h"
+#include "stress.h"
+
+// Short integrals of func1, each refining to about a thousand evaluations
+#define MINWIDTH 1.0e-4
+#define MAXWIDTH 1.0e-3
+#define TOL      1.0e-6
+
+// Idle modes of the solver run one after another
+static const char *modes[] = { "spin", "park", "yield" };
+
+static uint64_t seed = 88172645463325252ULL;
+
+static double uniform(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (seed >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Serial adaptive Simpson with the same points and acceptance test as the
+// queue solvers. It refines exactly the same intervals, so only the order in
+// which the parts are summed differs. mass is the sum of the magnitudes of
+// the parts, which bounds the rounding error of summing them.
+double reference(double left, double right, double tol, double f_left, double f_mid, double f_right,
+                 long *evaluations, double *mass)
+{
+    double h = right - left;
+    double c = (left + right) / 2.0;
+    double d = (left + c) / 2.0;
+    double e = (c + right) / 2.0;
+    double fd = func1(d);
+    double fe = func1(e);
+    *evaluations += 2;
+
+    double q1 = h / 6.0  * (f_left + 4.0 * f_mid + f_right);
+    double q2 = h / 12.0 * (f_left + 4.0 * fd + 2.0 * f_mid + 4.0 * fe + f_right);
+
+    if ((fabs(q2 - q1) < tol) ||
+        unresolvable(left, right, f_left, fd, f_mid, fe, f_right, q1, q2, 0.0)) {
+        double part = q2 + (q2 - q1) / 15.0;
+        *mass += fabs(part);
+        return part;
+    }
+
+    return reference(left, c, tol, f_left, fd, f_mid, evaluations, mass)
+         + reference(c, right, tol, f_mid, fe, f_right, evaluations, mass);
+}
+
+int compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Print the 50th, 90th and 99th percentiles and maximum in microseconds
+void distribution(const char *name, double *values, int count)
+{
+    qsort(values, count, sizeof(double), compare);
+
+    printf("%s(us) p50/p90/p99/max = %.1f %.1f %.1f %.1f\n", name,
+           values[count / 2] * 1e6, values[count * 9 / 10] * 1e6,
+           values[count * 99 / 100] * 1e6, values[count - 1] * 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    // stress_<solver> [runs [probability [max delay us]]]
+    int runs           = (argc > 1) ? atoi(argv[1]) : 2000;
+    double probability = (argc > 2) ? atof(argv[2]) : 0.05;
+    double max_delay   = (argc > 3) ? atof(argv[3]) * 1e-6 : 50e-6;
+
+    if (runs < 1) {
+        printf("At least one run is needed - exiting\n");
+        exit(1);
+    }
+
+    const char *solver = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+
+    printf("Solver: %s\n", solver);
+    printf("Threads: %d\n", omp_get_max_threads());
+    printf("Runs: %d\n", runs);
+    printf("Delay probability = %f\n", probability);
+    printf("Max delay(us) = %f\n", max_delay * 1e6);
+
+    double *left      = (double *)malloc(sizeof(double) * runs);
+    double *right     = (double *)malloc(sizeof(double) * runs);
+    double *expected  = (double *)malloc(sizeof(double) * runs);
+    double *mass      = (double *)malloc(sizeof(double) * runs);
+    long *evaluations = (long *)malloc(sizeof(long) * runs);
+    double *times     = (double *)malloc(sizeof(double) * runs);
+    double *latencies = (double *)malloc(sizeof(double) * runs);
+    if (!left || !right || !expected || !mass || !evaluations || !times || !latencies) {
+        printf("Failed to allocate runs - exiting\n");
+        exit(1);
+    }
+
+    // The same integrals are used for every mode, with their expected
+    // results and evaluation counts computed serially
+    for (int i = 0; i < runs; ++i) {
+        left[i] = 10.0 * uniform();
+        right[i] = left[i] + MINWIDTH + (MAXWIDTH - MINWIDTH) * uniform();
+
+        evaluations[i] = 3;
+        mass[i] = 0.0;
+        expected[i] = reference(left[i], right[i], TOL, func1(left[i]), func1((left[i] + right[i]) / 2.0),
+                                func1(right[i]), &evaluations[i], &mass[i]);
+    }
+
+    struct Integrand integrand = { func1_batch, NULL, NULL, 0, NULL, 0.0, func1_cost_hook };
+    stress_configure(probability, max_delay);
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        setenv("SOLVER_IDLE", modes[m], 1);
+
+        int failures = 0, early = 0, early_runs = 0;
+        long total_evaluations = 0;
+        long delays[STRESS_POINTS];
+
+        for (int p = 0; p < STRESS_POINTS; ++p) {
+            delays[p] = stress_delays(p);
+        }
+
+        double start = omp_get_wtime();
+
+        for (int i = 0; i < runs; ++i) {
+            struct SolverStats stats = { 0 };
+            int run_early;
+
+            stress_reset();
+
+            double run_start = omp_get_wtime();
+            double quad = integrate(&integrand, left[i], right[i], TOL, &stats);
+            times[i] = omp_get_wtime() - run_start;
+
+            stress_collect(&latencies[i], &run_early);
+            early += run_early;
+            early_runs += (run_early > 0);
+            total_evaluations += stats.evaluations;
+
+            // Any interleaving must refine the same intervals and only round
+            // the sum differently. Speculative evaluations of intervals that
+            // did not split are on top of those.
+            if (stats.evaluations - stats.wasted != evaluations[i] || fabs(quad - expected[i]) > 1e-10 * mass[i]) {
+                if (failures < 10) {
+                    printf("Failure: [%.17g, %.17g] Result = %.17e expected %.17e Evaluations = %ld expected %ld\n",
+                           left[i], right[i], quad, expected[i], stats.evaluations, evaluations[i]);
+                }
+                failures++;
+            }
+        }
+
+        double elapsed = omp_get_wtime() - start;
+
+        printf("\nIdle mode: %s\n", modes[m]);
+        printf("Failures = %d\n", failures);
+        printf("Throughput(integrals/s) = %f\n", runs / elapsed);
+        printf("Throughput(evaluations/s) = %f\n", total_evaluations / elapsed);
+        distribution("Run time", times, runs);
+        distribution("Exit latency", latencies, runs);
+        printf("Early exits = %d\n", early);
+        printf("Runs with early exits = %d\n", early_runs);
+        printf("Delays dequeue/steal/terminate = %ld %ld %ld\n",
+               stress_delays(STRESS_DEQUEUE) - delays[STRESS_DEQUEUE],
+               stress_delays(STRESS_STEAL) - delays[STRESS_STEAL],
+               stress_delays(STRESS_TERMINATE) - delays[STRESS_TERMINATE]);
+
+        if (failures > 0) {
+            printf("Wrong results under stress - exiting\n");
+            exit(1);
+        }
+    }
+
+    free(left);
+    free(right);
+    free(expected);
+    free(mass);
+    free(evaluations);
+    free(times);
+    free(latencies);
+}
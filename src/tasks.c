@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "tasks.h"
+
+// Deque of a worker. The owner pushes and pops at the bottom without a lock
+// and thieves take from the top while holding the lock. Both sides publish
+// their index before reading the other one, so that when they race for the
+// last task at least one of them notices and the owner settles it under the
+// lock (the THE protocol of Cilk-5).
+struct Worker {
+    struct Task *deque[TASKS_DEQUE];
+    long top;         // next task to steal
+    long bottom;      // next free slot
+    omp_lock_t lock;  // taken by thieves, and by the owner on a conflict
+
+    uint64_t random;  // xorshift state for picking victims
+    long spawned, stolen, steals;
+};
+
+static struct Worker *workers = NULL;
+static int worker_count = 0;
+static int finished = 0;
+
+// Worker of the calling thread
+static struct Worker *self = NULL;
+#pragma omp threadprivate(self)
+
+static inline int next_victim(struct Worker *worker)
+{
+    worker->random ^= worker->random >> 12;
+    worker->random ^= worker->random << 25;
+    worker->random ^= worker->random >> 27;
+
+    return (int)(((worker->random * 0x2545f4914f6cdd1dULL) >> 32) % worker_count);
+}
+
+// push a task to the bottom of the own deque
+static void push(struct Worker *worker, struct Task *task)
+{
+    long bottom = worker->bottom;
+
+    if (bottom == TASKS_DEQUE) {
+        printf("Maximum task deque size exceeded - exiting\n");
+        exit(1);
+    }
+
+    worker->deque[bottom] = task;
+
+    #pragma omp flush
+    #pragma omp atomic write
+    worker->bottom = bottom + 1;
+}
+
+// pop the task at the bottom of the own deque, or NULL if it was stolen
+static struct Task *pop(struct Worker *worker)
+{
+    long bottom = worker->bottom - 1;
+    long top;
+
+    #pragma omp atomic write
+    worker->bottom = bottom;
+    #pragma omp flush
+    #pragma omp atomic read
+    top = worker->top;
+
+    if (bottom >= top)
+        return worker->deque[bottom];
+
+    // A thief may be taking the same task, wait for it to finish
+    omp_set_lock(&worker->lock);
+
+    #pragma omp atomic read
+    top = worker->top;
+
+    struct Task *task = NULL;
+    if (bottom >= top) {
+        task = worker->deque[bottom];
+    } else {
+        // Every task was stolen, so the deque can start from the beginning
+        #pragma omp atomic write
+        worker->top = 0;
+        #pragma omp atomic write
+        worker->bottom = 0;
+    }
+
+    omp_unset_lock(&worker->lock);
+
+    return task;
+}
+
+// take the task at the top of another worker's deque, or NULL if there is
+// none or its lock is busy
+static struct Task *steal(struct Worker *victim)
+{
+    if (!omp_test_lock(&victim->lock))
+        return NULL;
+
+    long top = victim->top;
+    long bottom;
+
+    #pragma omp atomic write
+    victim->top = top + 1;
+    #pragma omp flush
+    #pragma omp atomic read
+    bottom = victim->bottom;
+
+    struct Task *task = NULL;
+    if (top < bottom) {
+        task = victim->deque[top];
+    } else {
+        #pragma omp atomic write
+        victim->top = top;
+    }
+
+    omp_unset_lock(&victim->lock);
+
+    return task;
+}
+
+// run a stolen task and tell its spawner
+static void run_stolen(struct Worker *worker, struct Task *task)
+{
+    #pragma omp atomic write
+    task->thief = (int)(worker - workers);
+    worker->stolen++;
+
+    task->run(task->arg);
+
+    #pragma omp flush
+    #pragma omp atomic write
+    task->done = 1;
+}
+
+void task_spawn(struct Task *task, void (*run)(void *), void *arg)
+{
+    assert(task && run && self);
+
+    task->run = run;
+    task->arg = arg;
+    task->done = 0;
+    task->thief = -1;
+
+    self->spawned++;
+    push(self, task);
+}
+
+void task_sync(struct Task *task)
+{
+    assert(task && self);
+
+    struct Worker *worker = self;
+    struct Task *popped = pop(worker);
+
+    if (popped) {
+        assert(popped == task);
+        task->run(task->arg);
+        return;
+    }
+
+    // The task was stolen. Rather than wait, take work from the thief, which
+    // is what the task itself spawns, or from a random worker before the
+    // thief is known.
+    while (1) {
+        int done;
+        #pragma omp atomic read
+        done = task->done;
+
+        if (done)
+            break;
+
+        int thief;
+        #pragma omp atomic read
+        thief = task->thief;
+
+        struct Worker *victim = &workers[(thief >= 0) ? thief : next_victim(worker)];
+        if (victim == worker)
+            continue;
+
+        worker->steals++;
+        struct Task *other = steal(victim);
+        if (other)
+            run_stolen(worker, other);
+    }
+    #pragma omp flush
+}
+
+void tasks_run(void (*root)(void *), void (*leave)(void *), void *arg, struct TaskStats *stats)
+{
+    assert(root && !workers);
+
+    worker_count = omp_get_max_threads();
+    workers = (struct Worker *)malloc(sizeof(struct Worker) * worker_count);
+    if (!workers) {
+        printf("Failed to allocate task workers - exiting\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < worker_count; ++i) {
+        workers[i].top = 0;
+        workers[i].bottom = 0;
+        workers[i].random = 0x9e3779b97f4a7c15ULL * (i + 1);
+        workers[i].spawned = workers[i].stolen = workers[i].steals = 0;
+        omp_init_lock(&workers[i].lock);
+    }
+
+    finished = 0;
+
+#pragma omp parallel num_threads(worker_count) default(none) shared(workers, worker_count, finished, root, leave, arg)
+    {
+        self = &workers[omp_get_thread_num()];
+
+        if (omp_get_thread_num() == 0) {
+            // Every spawned task is synced before root returns
+            root(arg);
+
+            #pragma omp atomic write
+            finished = 1;
+        } else {
+            while (1) {
+                int done;
+                #pragma omp atomic read
+                done = finished;
+
+                if (done)
+                    break;
+
+                struct Worker *victim = &workers[next_victim(self)];
+                if (victim == self)
+                    continue;
+
+                self->steals++;
+                struct Task *task = steal(victim);
+                if (task)
+                    run_stolen(self, task);
+            }
+        }
+
+        if (leave)
+            leave(arg);
+
+        self = NULL;
+    }
+
+    if (stats) {
+        stats->spawned = stats->stolen = stats->steals = 0;
+        for (int i = 0; i < worker_count; ++i) {
+            stats->spawned += workers[i].spawned;
+            stats->stolen += workers[i].stolen;
+            stats->steals += workers[i].steals;
+        }
+    }
+
+    for (int i = 0; i < worker_count; ++i) {
+        omp_destroy_lock(&workers[i].lock);
+    }
+
+    free(workers);
+    workers = NULL;
+}
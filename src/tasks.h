@@ -0,0 +1,42 @@
+#ifndef TASKS_H
+#define TASKS_H
+
+#include <stdbool.h>
+
+// Spawned tasks a worker can hold at once, bounded by the recursion depth
+#define TASKS_DEQUE 4096
+
+// Lightweight fork-join runtime. A task frame is allocated on the stack of
+// the function that spawns it and pushed to the bottom of the worker's
+// deque without a lock. The spawner carries on and at task_sync either pops
+// the task back and runs it inline or, if another worker stole it, steals
+// work from that worker until the task is done.
+struct Task {
+    void (*run)(void *); // task body
+    void *arg;           // argument of the body, usually in the same frame
+    int done;            // set by a thief once the body has returned
+    int thief;           // worker that stole the task, or -1
+};
+
+// Counts of a run, summed over the workers
+struct TaskStats {
+    long spawned; // tasks spawned
+    long stolen;  // tasks run by another worker than their spawner
+    long steals;  // steal attempts, successful or not
+};
+
+// Run root(arg) on a team of omp_get_max_threads() workers and return once
+// it and every task it spawned are done. Each worker calls leave(arg) before
+// the team ends, to combine any per-thread state. leave may be NULL.
+void tasks_run(void (*root)(void *), void (*leave)(void *), void *arg, struct TaskStats *stats);
+
+// Make run(arg) available to other workers. task must stay in scope until
+// the matching task_sync, and tasks are synced in the reverse order of
+// their spawns.
+void task_spawn(struct Task *task, void (*run)(void *), void *arg);
+
+// Wait for a spawned task, running it on the calling worker if nobody has
+// stolen it
+void task_sync(struct Task *task);
+
+#endif